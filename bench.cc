@@ -0,0 +1,169 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/10/19
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/// Static file throughput of HttpServer, copy path against sendfile(2)
+///   mgbench [file_mb=64] [seconds=3] [connections=4]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server.h"
+
+using namespace mg;
+
+namespace bench {
+
+static int Connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// One request on a keep-alive connection, returns body bytes or -1
+static long Get(int fd, const std::string& req, std::string* body = nullptr) {
+  static thread_local std::vector<char> buf(1 << 20);
+  if (send(fd, req.data(), req.size(), 0) != (ssize_t)req.size())
+    return -1;
+  std::string head;
+  size_t pos;
+  while ((pos = head.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    if (n <= 0)
+      return -1;
+    head.append(buf.data(), n);
+  }
+  auto cl = head.find("Content-Length:");
+  if (cl == std::string::npos)
+    return -1;
+  long want = strtol(head.c_str() + cl + 15, nullptr, 10);
+  long got = head.size() - pos - 4;
+  if (body)
+    body->assign(head, pos + 4, std::string::npos);
+  while (got < want) {
+    ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    if (n <= 0)
+      return -1;
+    if (body)
+      body->append(buf.data(), n);
+    got += n;
+  }
+  return want;
+}
+
+static double CpuSeconds() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void Run(const std::string& dir, const std::string& blob, bool sendfile,
+                int port, int seconds, int conns) {
+  HttpSrvOptions opts;
+  opts.url = "http://127.0.0.1:" + std::to_string(port);
+  opts.serve_dir = dir;
+  opts.sendfile = sendfile;
+  HttpServer server(std::move(opts));
+  usleep(200000);
+  mg_log_set(MG_LL_ERROR);  // the loop raised it on start
+
+  /// a Range request must come back as exactly that slice
+  std::string slice;
+  int fd = Connect(port);
+  Get(fd,
+      "GET /blob.bin HTTP/1.1\r\nHost: b\r\nRange: bytes=1000-4999\r\n\r\n",
+      &slice);
+  close(fd);
+  bool range_ok = slice == blob.substr(1000, 4000);
+
+  std::atomic<bool> stop = false;
+  std::atomic<long> bytes = 0, reqs = 0;
+  std::vector<std::thread> clients;
+  double cpu = CpuSeconds();
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < conns; i++) {
+    clients.emplace_back([&] {
+      int fd = Connect(port);
+      const std::string req = "GET /blob.bin HTTP/1.1\r\nHost: b\r\n\r\n";
+      while (fd >= 0 && !stop) {
+        long n = Get(fd, req);
+        if (n < 0)
+          break;
+        bytes += n;
+        reqs++;
+      }
+      close(fd);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for (auto& t : clients)
+    t.join();
+  double secs = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - t0).count();
+  cpu = CpuSeconds() - cpu;
+  printf("%-9s %8.1f MB/s %6ld req  cpu %5.2f s/GB  range %s\n",
+         sendfile ? "sendfile" : "copy", bytes / secs / 1e6, reqs.load(),
+         cpu / (bytes / 1e9), range_ok ? "ok" : "FAIL");
+}
+
+}  // namespace bench
+
+int main(int argc, char** argv) {
+  size_t mb = argc > 1 ? atoi(argv[1]) : 64;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+  int conns = argc > 3 ? atoi(argv[3]) : 4;
+
+  char dir[] = "/tmp/mgbench.XXXXXX";
+  if (!mkdtemp(dir))
+    return 1;
+  std::string blob(mb << 20, '\0');
+  for (size_t i = 0; i < blob.size(); i++)
+    blob[i] = static_cast<char>(i * 2654435761u >> 24);
+  std::ofstream(std::string(dir) + "/blob.bin", std::ios::binary) << blob;
+
+  printf("%zu MB file, %d connections, %d s, cpu is client + server\n", mb,
+         conns, seconds);
+  bench::Run(dir, blob, false, 18080, seconds, conns);
+  bench::Run(dir, blob, true, 18081, seconds, conns);
+
+  unlink((std::string(dir) + "/blob.bin").c_str());
+  rmdir(dir);
+  return 0;
+}
@@ -23,38 +23,96 @@
 #include <mutex>
 #include <queue>
 #include <set>
+#include <vector>
 #include "connect.h"
+#include "connpool.h"
 #include "iloop.h"
+#include "mpsc.h"
 
 namespace mg {
 
 class IClient : public ILoop {
  public:
-  IClient() = default;
-  virtual ~IClient() { Stop(); }
+  explicit IClient(HttpPoolOptions pool = {}, const SlabOptions& slab = {})
+      : pool_(pool), handle_(std::make_shared<LoopHandle>()) {
+    handle_->loop = this;
+    EnableSlab(slab);
+    Start();
+  }
+  virtual ~IClient() {
+    {
+      /// connections outliving this fail SendAsync/PublishAsync from now on
+      std::unique_lock<std::shared_mutex> lock(handle_->mtx);
+      handle_->loop = nullptr;
+    }
+    Stop();
+  }
 
   template <class CONNECT, class... Args>
   IConnect::Ptr Create(Args&&... args) {
-    auto c = std::make_shared<CONNECT>(std::forward<Args>(args)...);
-    if (Add(c)) {
-      c->on_release = [&](IConnect::Ptr conn) {
-        this->Remove(conn);
-      };
-      return c;
-    }
-    return nullptr;
+    return Attach(std::make_shared<CONNECT>(std::forward<Args>(args)...));
   }
 
+  /// Schedule an already constructed connection on this loop
+  IConnect::Ptr Attach(IConnect::Ptr conn);
+  /// Number of connections currently owned by this loop
+  size_t Size();
+  /// Queue a write from any thread and wake the loop to carry it out
+  void Post(Outbound out);
+  /// Keep-alive HTTP connections, loop thread only
+  HttpConnPool& Pool() { return pool_; }
+  /// Shutting down, connections must not open again
+  using ILoop::Stopped;
+
  private:
   virtual bool EventLoop() override;
   bool Add(IConnect::Ptr conn);
   bool Remove(IConnect::Ptr conn);
-  IConnect* Pop();
+  std::queue<IConnect*> Pop();
+  void Dispatch();
 
  private:
   std::mutex mtx_;
   std::set<IConnect::Ptr> sess_set_;
   std::queue<IConnect*> sess_queue_;
+  MpscQueue<Outbound> outbox_;
+  HttpConnPool pool_;
+  std::shared_ptr<LoopHandle> handle_;
+};
+
+enum class Placement {
+  kRoundRobin,        // cycle through loops in order
+  kLeastConnections,  // loop owning the fewest connections
+  kHashHost,          // same host:port always lands on the same loop
+};
+
+/// Pick the index of the loop a new connection to url is placed on
+using Placer = std::function<size_t(
+    std::string_view url, const std::vector<std::unique_ptr<IClient>>& loops)>;
+
+class IClientPool {
+ public:
+  IClientPool(size_t threads = std::thread::hardware_concurrency(),
+              Placement placement = Placement::kRoundRobin,
+              const SlabOptions& slab = {});
+  IClientPool(size_t threads, Placer placer, const SlabOptions& slab = {});
+
+  template <class CONNECT, class... Args>
+  IConnect::Ptr Create(Args&&... args) {
+    auto c = std::make_shared<CONNECT>(std::forward<Args>(args)...);
+    return loops_[Place(c->Url())]->Attach(std::move(c));
+  }
+
+  size_t Size() const { return loops_.size(); }
+  /// Slab counters summed over every loop
+  SlabStats MemoryStats() const;
+
+ private:
+  size_t Place(std::string_view url);
+
+ private:
+  std::vector<std::unique_ptr<IClient>> loops_;
+  Placer placer_;
 };
 
 }  // namespace mg
\ No newline at end of file
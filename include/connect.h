@@ -20,6 +20,7 @@
  */
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include "iconnect.h"
@@ -29,52 +30,182 @@ namespace mg {
 
 using ConnectOptions = Options<IConnect>;
 
+struct HttpConnectOptions;
+
+/// Request line, Host and headers rendered once and copied by every
+/// HttpConnect that references it, for requests of identical shape. The
+/// request still sets the HTTP version from its own keep_alive and adds
+/// the Content-Type/Content-Length of its file.
+class HttpRequestTemplate {
+ public:
+  using Ptr = std::shared_ptr<const HttpRequestTemplate>;
+
+  /// Render method, url, headers and keep_alive of options
+  static Ptr Create(const HttpConnectOptions& options);
+  /// Complete head including the blank line, the body follows it
+  std::string_view Head() const { return head_; }
+
+ private:
+  friend class HttpConnect;
+  std::string head_;
+  size_t version_ = 0;  // offset of the '0' or '1' of HTTP/1.x in head_
+  bool typed_ = false;  // headers carry a Content-Type
+};
+
 struct HttpConnectOptions : ConnectOptions {
   using Ptr = std::shared_ptr<HttpConnectOptions>;
   std::string method;
   HttpHeaders headers;
   std::string body;
   std::string file;
+  bool keep_alive = false; // HTTP/1.1 over the IClient connection pool
+  HttpRequestTemplate::Ptr request_template; // replaces method and headers
 
   OnHttpMessage<IConnect> on_message;
+  /// Streaming, set one of download or on_chunk: the response is not
+  /// buffered and on_message is not called. on_headers gets status and
+  /// headers, then the body goes out as it arrives, chunked decoded.
+  /// timeout turns into inactivity while the body flows.
+  std::string download;  // body written to this file, removed if cut short
+  OnHttpMessage<IConnect> on_headers;
+  /// Taking fewer bytes than offered stops reading until they are offered
+  /// again shortly, an empty chunk marks the end of the body
+  OnHttpChunk<IConnect> on_chunk;
 };
 
 struct MqttConnectOptions : ConnectOptions {
   using Ptr = std::shared_ptr<MqttConnectOptions>;
   uint8_t qos;
+  uint8_t version = 4;        // 5 for MQTT5, honouring Receive Maximum
+  size_t max_inflight = 256;  // QoS 1/2 publishes awaiting their ack
+  size_t max_queued = 65536;  // publishes waiting for room in the window
+  MqttLingerOptions linger;   // timer is in milliseconds, max_us rounds up
+  MqttReconnectOptions reconnect;  // on_close only fires once given up
   std::string user;
   std::string pass;
   std::vector<std::string> topics;
   OnMqttOpen<IConnect> on_mqtt_open;
-  OnMqttMessage<IConnect> on_message;
+  OnMqttMessage<IConnect> on_message;  // messages no handler matches
+  /// Topic filter to handler, see MqttConnect::Subscribe
+  std::map<std::string, OnMqttMessage<IConnect>> handlers;
 };
 
 using Socket = TcpConnect<ConnectOptions>;
 
 class HttpConnect : public TcpConnect<HttpConnectOptions> {
+  friend class HttpConnPool;
+
  public:
   HttpConnect(HttpConnectOptions options);
+  virtual ~HttpConnect();
 
  private:
   virtual void Init(struct mg_mgr* mgr) override;
   virtual void Handler(int ev, void* ev_data) override;
   void Request();
-  std::string ParseHeaders();
+  /// Feed options_.file to the connection, run on every MG_EV_WRITE
+  void Upload();
+  void CloseUpload();
+  /// Run on an idle keep-alive connection handed over by the pool
+  void Adopt(struct mg_connection* c);
+  /// Give up before any connection was assigned
+  void Abort(std::string_view cause);
+  bool Reusable(struct mg_http_message* hm) const;
+  /// Streaming response, see HttpConnectOptions::download
+  void StartDownload(struct mg_http_message* hm);
+  void Feed();
+  long Deliver(std::string_view chunk);
+  void EndDownload(bool complete);
 
  private:
+  struct Download;
+  static constexpr size_t kUploadChunk = 64 * 1024;
   struct mg_fd* mgfd_ = nullptr;
+  size_t upload_size_ = 0;  // bytes of options_.file
+  bool sendfile_ = false;   // options_.file handed to mg_sendfile
+  std::string pool_key_;   // set when running over the connection pool
+  bool reused_ = false;    // connection came from the idle list
+  bool answered_ = false;  // response headers received
+  std::unique_ptr<Download> download_;  // body being streamed
 };
 
+class MqttInflight;
+template <class V>
+class MqttTopicTrie;
+
 class MqttConnect : public TcpConnect<MqttConnectOptions> {
  public:
   MqttConnect(MqttConnectOptions options);
+  virtual ~MqttConnect();
+  /// With qos 1/2 the message is kept until acknowledged and waits while
+  /// max_inflight are in flight, false once max_queued are waiting
   bool Publish(MqttMessage msg);
+  /// Publish count messages serialized in one pass into one region of the
+  /// send buffer, returns how many were taken
+  size_t PublishBatch(const MqttMessage* msgs, size_t count);
+  size_t PublishBatch(const std::vector<MqttMessage>& msgs) {
+    return PublishBatch(msgs.data(), msgs.size());
+  }
+  /// Write publishes held back by linger now
+  void Flush();
+  /// Thread-safe Publish, topic and body are copied
+  bool PublishAsync(MqttMessage msg);
+  /// Subscribe topic now when the session is up and again on every new one
   bool Subscribe(std::string_view topic);
+  /// Deliver messages matching filter, `+` and `#` wildcards included, to
+  /// handler instead of on_message. Subscribed now when the session is up
+  /// and again on every new one; replaces the handler of an equal filter.
+  bool Subscribe(std::string_view filter, OnMqttMessage<IConnect> handler);
+  /// Drop the handler of filter and unsubscribe it
+  bool Unsubscribe(std::string_view filter);
+  /// Close for good, a pending reconnect included
+  bool kill() override;
+  /// QoS 1/2 publishes sent and not yet acknowledged
+  size_t Inflight() const;
+  /// QoS 1/2 publishes waiting for room in the window
+  size_t Queued() const;
 
  private:
   virtual void Init(struct mg_mgr* mgr) override;
   virtual void Handler(int ev, void* ev_data) override;
   virtual void OnTimeout() override;
+  virtual void Write(const Outbound& out) override;
+  virtual bool Reconnecting() const override { return waiting_; }
+  virtual bool End() override;
+  /// Connection lost: arm the backoff timer, false to close for good
+  bool Retry();
+  /// Delay before reconnect attempt attempts + 1, drawn from the upper half
+  /// of the doubled ceiling by rnd
+  static uint64_t Backoff(const MqttReconnectOptions& r, uint32_t attempts,
+                          uint32_t rnd);
+  /// CONNACK accepted, size the window and resend what was in flight
+  void Resume(struct mg_mqtt_message* mm);
+  static void Linger(void* arg);
+  void StopLinger();
+  /// Hand a received message to the handlers matching its topic
+  void Dispatch(const MqttMessage& msg);
+  /// Add filter to those subscribed per session, false if already there
+  bool Track(std::string_view filter);
+  /// One SUBSCRIBE packet for count filters
+  void SendSubscribe(const std::string* filters, size_t count);
+  void SendUnsubscribe(std::string_view filter);
+
+ private:
+  using Routes = MqttTopicTrie<OnMqttMessage<IConnect>>;
+  std::unique_ptr<MqttInflight> inflight_;
+  std::unique_ptr<Routes> routes_;
+  std::vector<std::string> filters_;  // subscribed per session
+  /// Handler changes made while dispatching, an empty handler unsubscribes
+  std::vector<std::pair<std::string, OnMqttMessage<IConnect>>> deferred_;
+  bool dispatching_ = false;
+  bool session_ = false;  // CONNACK seen, subscriptions may go out
+  bool open_ = false;  // CONNACK accepted, publishes may go out
+  std::string held_;   // QoS 0 packets held back by linger or offline
+  size_t holding_ = 0; // publishes held back by linger or offline
+  uint32_t attempts_ = 0;  // reconnects since the last accepted session
+  std::atomic<bool> waiting_ = false;  // connection lost, timer reconnects
+  std::atomic<bool> stopped_ = false;  // killed, no more reconnects
+  struct mg_timer* linger_timer_ = nullptr;
 };
 
 }  // namespace mg
@@ -20,25 +20,88 @@
  */
 #pragma once
 
+#include <cctype>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
 #include <string_view>
 #include <functional>
+#include <utility>
+
+struct mg_connection;
 
 namespace mg {
 
+class TlsContext;
+template <class OPTIONS>
+class IServer;
+
 using HttpHeaders = std::map<std::string, std::string>;
 
+/// Headers of a received message viewed in place, valid during the callback
+/// only, Copy() them to keep them longer
+class HttpHeaderView {
+ public:
+  using Field = std::pair<std::string_view, std::string_view>;
+
+  HttpHeaderView() = default;
+  HttpHeaderView(const Field* fields, size_t size)
+      : fields_(fields), size_(size) {}
+
+  const Field* begin() const { return fields_; }
+  const Field* end() const { return fields_ + size_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /// Case-insensitive lookup of the first field called name
+  const Field* find(std::string_view name) const {
+    for (auto* f = begin(); f != end(); f++) {
+      if (Equal(f->first, name))
+        return f;
+    }
+    return nullptr;
+  }
+  /// Value of the first field called name, empty if there is none
+  std::string_view operator[](std::string_view name) const {
+    auto* f = find(name);
+    return f ? f->second : std::string_view();
+  }
+  /// Owning copy, the first of duplicated names wins
+  HttpHeaders Copy() const {
+    HttpHeaders headers;
+    for (auto& [name, value] : *this)
+      headers.emplace(name, value);
+    return headers;
+  }
+
+ private:
+  static bool Equal(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); i++) {
+      if (std::tolower(static_cast<unsigned char>(a[i])) !=
+          std::tolower(static_cast<unsigned char>(b[i])))
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  const Field* fields_ = nullptr;
+  size_t size_ = 0;
+};
+
 struct HttpMessage {
   int status;
-  HttpHeaders headers;
+  HttpHeaderView headers;  // views into the receive buffer
   std::string_view body;
 };
 
 struct MqttMessage {
   std::string_view topic;
   std::string_view body;
+  bool retain = false;  // kept by the broker for later subscribers
 };
 
 template <class T>
@@ -59,6 +122,104 @@ using OnHttpMessage = std::function<void(T*, HttpMessage)>;
 template <class T>
 using OnMqttMessage = std::function<void(T*, MqttMessage)>;
 
+/// What an OnWatermark is about: the connection itself for clients, the
+/// accepted connection for servers
+template <class T>
+struct WatermarkTarget {
+  using Type = T;
+};
+template <class OPTIONS>
+struct WatermarkTarget<IServer<OPTIONS>> {
+  using Type = ::mg_connection;
+};
+
+/// Send buffer above BufferOptions::send_high (true) or back down to
+/// send_low (false)
+template <class T>
+using OnWatermark =
+    std::function<void(typename WatermarkTarget<T>::Type*, bool)>;
+
+/// Streamed body bytes, returns how many were taken, < 0 aborts
+template <class T>
+using OnHttpChunk = std::function<long(T*, std::string_view)>;
+
+
+/// Keep-alive connection pool of an IClient, see HttpConnectOptions
+struct HttpPoolOptions {
+  size_t max_idle = 8;         // idle connections kept per host
+  size_t max_per_host = 16;    // open connections per host, then queue
+  uint32_t idle_timeout = 30000; // close idle connections after, milliseconds
+};
+
+/// Coalescing of MqttConnect publishes made one at a time: they are held
+/// back and written together, like Nagle on the socket
+struct MqttLingerOptions {
+  uint32_t max_us = 0;      // oldest held publish waits at most, 0 for off
+  size_t max_messages = 0;  // written as soon as this many are held
+};
+
+/// Reconnect of an MqttConnect whose connection is lost or refused. Delays
+/// double from min_ms up to max_ms and are drawn at random from the upper
+/// half of that, so clients of a failed broker do not come back in step.
+struct MqttReconnectOptions {
+  bool enable = false;
+  uint32_t min_ms = 500;      // first delay, milliseconds
+  uint32_t max_ms = 30000;    // delay cap, milliseconds
+  uint32_t max_attempts = 0;  // failures in a row before giving up, 0 for never
+};
+
+/// In-memory serve_dir cache of an HttpServer, see HttpSrvOptions
+struct HttpCacheOptions {
+  bool enable = false;
+  size_t max_file = 1 << 20;    // bigger files keep going to disk
+  size_t max_total = 64 << 20;  // bytes held, later files go to disk
+  bool precompressed = true;    // serve sibling .br/.gz by Accept-Encoding
+};
+
+/// Per-loop pools for mongoose connections and their buffers, replacing a
+/// calloc/free pair for each accept and buffer growth
+struct SlabOptions {
+  bool enable = false;
+  size_t conns_per_slab = 64;    // connections carved from one allocation
+  size_t max_class = 256 << 10;  // bigger buffers go to the heap
+  size_t max_cached = 16 << 20;  // idle buffer bytes kept, the rest is freed
+};
+
+/// Counters of the pools of one or more loops
+struct SlabStats {
+  size_t conns = 0;           // connections live
+  size_t conn_allocs = 0;     // connections handed out
+  size_t conn_reused = 0;     // of them from a freed slot
+  size_t slabs = 0;           // connection slabs allocated
+  size_t buffers = 0;         // buffers live
+  size_t buffer_allocs = 0;   // buffers handed out
+  size_t buffer_reused = 0;   // of them from a free list
+  size_t buffer_heap = 0;     // of them above max_class
+  size_t cached_bytes = 0;    // idle in free lists
+
+  SlabStats& operator+=(const SlabStats& o) {
+    conns += o.conns;
+    conn_allocs += o.conn_allocs;
+    conn_reused += o.conn_reused;
+    slabs += o.slabs;
+    buffers += o.buffers;
+    buffer_allocs += o.buffer_allocs;
+    buffer_reused += o.buffer_reused;
+    buffer_heap += o.buffer_heap;
+    cached_bytes += o.cached_bytes;
+    return *this;
+  }
+};
+
+/// Memory profile of each connection, zeros keep the mongoose defaults
+struct BufferOptions {
+  size_t initial = 0;   // recv and send capacity allocated at open
+  size_t step = 0;      // allocation granularity, MG_IO_SIZE by default
+  uint8_t growth = 0;   // capacity multiplier when full, steps when 1 or 0
+  size_t max_recv = 0;  // unread bytes before an error, MG_MAX_RECV_SIZE
+  size_t send_high = 0; // pending send bytes raising on_watermark, 0 for off
+  size_t send_low = 0;  // pending send bytes clearing it
+};
 
 template <class T>
 struct Options {
@@ -67,10 +228,13 @@ struct Options {
   std::string ca;
   std::string cert;
   std::string key;
+  std::shared_ptr<TlsContext> tls; // parsed once and shared, over ca/cert/key
   uint32_t timeout; // timeout of connection, milliseconds
   OnRead<T> on_read; // data received
   OnClose<T> on_close; // connection closed
   OnReady<T> on_ready; // connection established
+  BufferOptions buffers; // per connection, also for accepted ones
+  OnWatermark<T> on_watermark; // backpressure on the send side
 };
 
 }
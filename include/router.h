@@ -0,0 +1,209 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/14
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "options.h"
+
+struct mg_connection;
+
+namespace mg {
+
+/// Path parameters of a routed request, names view the route pattern and
+/// values view the request path (not url-decoded)
+class HttpParams {
+ public:
+  static constexpr size_t kMax = 8;  // parameters per route
+  using Field = std::pair<std::string_view, std::string_view>;
+
+  const Field* begin() const { return fields_; }
+  const Field* end() const { return fields_ + size_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /// Value of the parameter called name, empty if there is none
+  std::string_view operator[](std::string_view name) const {
+    for (auto& [k, v] : *this) {
+      if (k == name)
+        return v;
+    }
+    return std::string_view();
+  }
+
+ private:
+  friend class HttpRouter;
+  friend class HttpServer;
+  Field fields_[kMax];
+  size_t size_ = 0;
+};
+
+/// Request handed to a route, every view is valid during the handler only
+struct HttpRequest {
+  std::string_view method;
+  std::string_view path;  // uri without the query, not url-decoded
+  std::string_view query;
+  HttpHeaderView headers;
+  std::string_view body;
+  HttpParams params;
+};
+
+/// Reply side of a routed request. On the loop thread it writes straight to
+/// the connection; with HttpSrvOptions::handler_threads it is a handle that
+/// may be copied and replied from any thread, the reply being posted back
+/// to the loop owning the connection. A request left without a reply gets
+/// a 500 once its last handle is gone.
+class HttpResponse {
+ public:
+  /// Carries rendered responses back to the owning loop
+  class Poster {
+   public:
+    virtual ~Poster() = default;
+    /// false when the request was already answered
+    virtual bool Post(std::string response) = 0;
+  };
+
+  explicit HttpResponse(struct mg_connection* c) : c_(c) {}
+  explicit HttpResponse(std::shared_ptr<Poster> poster)
+      : poster_(std::move(poster)) {}
+
+  /// Send a complete response with Content-Length, once per request
+  void Reply(int status, std::string_view body = {},
+             const HttpHeaders& headers = {});
+  bool Replied() const { return replied_; }
+
+ private:
+  struct mg_connection* c_ = nullptr;
+  std::shared_ptr<Poster> poster_;
+  bool replied_ = false;
+};
+
+/// Receives a request body as it arrives, on the loop thread of the
+/// connection, see HttpRouter::Upload
+class HttpBodySink {
+ public:
+  using Ptr = std::unique_ptr<HttpBodySink>;
+  virtual ~HttpBodySink() = default;
+
+  /// Body bytes in arrival order, returns how many were taken. Taking fewer
+  /// stops reading the connection and offers the rest again shortly, < 0
+  /// fails the request with 500.
+  virtual long Write(std::string_view chunk) = 0;
+  /// Whole body taken, reply now or the request gets a 500
+  virtual void Finish(HttpResponse& res) = 0;
+  /// Connection lost or body malformed before the end
+  virtual void Abort() {}
+};
+
+/// Body written straight to a file, 201 once complete, removed if aborted
+class HttpFileSink : public HttpBodySink {
+ public:
+  explicit HttpFileSink(std::string path);
+  virtual ~HttpFileSink();
+
+  virtual long Write(std::string_view chunk) override;
+  virtual void Finish(HttpResponse& res) override;
+  virtual void Abort() override;
+
+ private:
+  std::string path_;
+  int fd_;
+  size_t size_ = 0;
+};
+
+/// Method and path pattern to handler, matched through a compressed radix
+/// tree. Patterns are literal text with `:name` segments and a trailing
+/// `*name` matching the rest of the path, e.g. /api/v1/items/:id.
+/// Routes are added before the server starts, lookups are lock-free.
+class HttpRouter {
+ public:
+  using Handler = std::function<void(const HttpRequest&, HttpResponse&)>;
+  /// Called once the headers are in, body still empty. Returns the sink of
+  /// the body, or null after replying to refuse it.
+  using Opener =
+      std::function<HttpBodySink::Ptr(const HttpRequest&, HttpResponse&)>;
+  struct Route {
+    Handler handler;  // whole request buffered
+    Opener opener;    // body streamed
+  };
+
+  HttpRouter() : nodes_(1) {}
+
+  /// Empty method matches any, false on a malformed or conflicting pattern
+  bool Add(std::string_view method, std::string_view pattern, Handler handler);
+  /// Stream the body of matching requests through a sink instead of
+  /// buffering it, for uploads past MG_MAX_RECV_SIZE
+  bool Upload(std::string_view method, std::string_view pattern,
+              Opener opener);
+  bool Get(std::string_view pattern, Handler handler) {
+    return Add("GET", pattern, std::move(handler));
+  }
+  bool Post(std::string_view pattern, Handler handler) {
+    return Add("POST", pattern, std::move(handler));
+  }
+  bool Put(std::string_view pattern, Handler handler) {
+    return Add("PUT", pattern, std::move(handler));
+  }
+  bool Delete(std::string_view pattern, Handler handler) {
+    return Add("DELETE", pattern, std::move(handler));
+  }
+  bool Any(std::string_view pattern, Handler handler) {
+    return Add("", pattern, std::move(handler));
+  }
+
+  bool empty() const { return nodes_.size() == 1 && nodes_[0].handlers.empty(); }
+  /// Some route streams its body
+  bool uploads() const { return uploads_; }
+
+  /// Route for method and path with params filled, nullptr if none.
+  /// allowed turns false when the path has routes but not for method.
+  const Route* Match(std::string_view method, std::string_view path,
+                     HttpParams& params, bool* allowed = nullptr) const;
+
+ private:
+  struct Node {
+    std::string prefix;             // literal text, empty for :name and *name
+    std::string name;               // parameter name of :name and *name
+    std::vector<uint32_t> statics;  // literal children, distinct first chars
+    uint32_t param = 0;             // :name child, 0 for none
+    uint32_t wildcard = 0;          // *name child, 0 for none
+    std::vector<std::pair<std::string, Route>> handlers;  // by method
+  };
+
+  bool Insert(std::string_view method, std::string_view pattern, Route route);
+  uint32_t AddStatic(uint32_t n, std::string_view text);
+  uint32_t AddParam(uint32_t n, bool wildcard, std::string_view name);
+  const Route* Find(uint32_t n, std::string_view method, std::string_view path,
+                    HttpParams& params, bool& found) const;
+  const Route* Pick(const Node& node, std::string_view method,
+                    bool& found) const;
+
+ private:
+  std::vector<Node> nodes_;  // nodes_[0] is the root
+  bool uploads_ = false;
+};
+
+}  // namespace mg
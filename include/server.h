@@ -20,27 +20,57 @@
  */
 #pragma once
 
+#include <memory>
+#include <vector>
 #include "iserver.h"
 #include "options.h"
+#include "router.h"
 
 namespace mg {
 
 struct HttpSrvOptions;
 struct MqttSrvOptions;
+class StaticCache;
+class WorkPool;
 using HttpSrvBase = IServer<HttpSrvOptions>;
 using MqttSrvBase = IServer<MqttSrvOptions>;
 
 struct HttpSrvOptions : Options<HttpSrvBase> {
   using Ptr = std::shared_ptr<HttpSrvOptions>;
   std::string serve_dir; // can not use .. for relative path
-  //TODO
-  OnHttpMessage<HttpSrvBase> on_message;
+  // listener threads sharing url via SO_REUSEPORT, callbacks must be
+  // thread-safe when greater than 1
+  size_t workers = 1;
+  // serve_dir files go out with sendfile(2) on plain TCP, Range included
+  bool sendfile = true;
+  // keep small serve_dir files and their response heads in memory
+  HttpCacheOptions cache;
+  // routes tried before serve_dir, handlers must be thread-safe with workers,
+  // upload sinks always run on the loop thread of their connection
+  HttpRouter router;
+  // routes run on this many threads instead of the loop, 0 keeps them inline
+  size_t handler_threads = 0;
+  // requests queued for handler_threads, past it connections stop being read
+  size_t handler_queue = 1024;
+  // pooled connections and buffers, one pool per worker loop
+  SlabOptions slab;
 };
 
 struct MqttSrvOptions : Options<MqttSrvBase> {
-  using Ptr = std::shared_ptr<HttpSrvOptions>;
-  //TODO
-  OnHttpMessage<MqttSrvBase> on_message;
+  using Ptr = std::shared_ptr<MqttSrvOptions>;
+  // QoS 1 deliveries awaiting PUBACK, per client
+  size_t max_inflight = 64;
+  // deliveries held per client once its send window is full, later ones
+  // are dropped
+  size_t max_queued = 10000;
+  // pending send bytes per client, past it deliveries queue by reference
+  size_t send_window = 64 << 10;
+  // keep retained messages for later subscribers
+  bool retain = true;
+  // pooled connections and buffers of the loop
+  SlabOptions slab;
+  // every PUBLISH received, before the fan-out
+  OnMqttMessage<MqttSrvBase> on_message;
 };
 
 class HttpServer : public HttpSrvBase {
@@ -48,16 +78,74 @@ class HttpServer : public HttpSrvBase {
   HttpServer(HttpSrvOptions options);
   virtual ~HttpServer();
 
+  /// Slab counters summed over every worker loop
+  SlabStats MemoryStats() const;
+
  private:
   virtual void Handler(struct mg_connection* c, int ev, void* ev_data) override;
+  bool Route(struct mg_connection* c, struct mg_http_message* hm);
+  void Dispatch(struct mg_connection* c, struct mg_http_message* hm,
+                const HttpRouter::Handler* handler, const HttpRequest& req);
+  bool StartUpload(struct mg_connection* c, struct mg_http_message* hm);
+  void Feed(struct mg_connection* c);
+  void EndUpload(struct mg_connection* c, int status);
 
  private:
   virtual void InitLoop() override;
+  virtual bool EventLoop() override;
   virtual void UninitLoop() override {
     ILoop::UninitLoop();
     LOGI("HttpServer UninitLoop");
   }
 
+ private:
+  class Worker;
+  struct Replies;
+  struct Job;
+  class AsyncReply;
+  struct Upload;
+  void Deliver(Replies& replies);
+
+  std::unique_ptr<StaticCache> cache_;
+  std::vector<std::shared_ptr<Replies>> replies_;  // per loop, [0] is ours
+  std::unique_ptr<WorkPool> pool_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+/// MQTT 3.1.1 broker on one loop. Subscriptions live in a topic trie and
+/// a PUBLISH is serialized once, every subscriber holding a reference to
+/// it until its send buffer has room. QoS 2 publishes are taken and
+/// delivered as QoS 1; sessions end with their connection.
+class MqttServer : public MqttSrvBase {
+ public:
+  MqttServer(MqttSrvOptions options);
+  virtual ~MqttServer();
+
+ private:
+  struct Packet;
+  struct Session;
+  struct Subscriptions;
+
+  virtual void Handler(struct mg_connection* c, int ev, void* ev_data) override;
+  virtual void InitLoop() override;
+  void Command(struct mg_connection* c, struct mg_mqtt_message* mm);
+  bool Connect(struct mg_connection* c, struct mg_mqtt_message* mm);
+  void Subscribe(struct mg_connection* c, struct mg_mqtt_message* mm);
+  void Unsubscribe(struct mg_connection* c, struct mg_mqtt_message* mm);
+  void Publish(struct mg_connection* c, struct mg_mqtt_message* mm);
+  void Close(struct mg_connection* c);
+  /// Write p to s now or queue it behind the send window
+  void Deliver(Session* s, const std::shared_ptr<const Packet>& p, uint8_t qos,
+               bool retain);
+  bool Send(Session* s, const std::shared_ptr<const Packet>& p, uint8_t qos,
+            bool retain);
+  /// Move queued deliveries into the send buffer while there is room
+  void Drain(Session* s);
+  /// Drop sessions silent past their keep-alive
+  static void Sweep(void* arg);
+
+ private:
+  std::unique_ptr<Subscriptions> subs_;
 };
 
 }  // namespace mg
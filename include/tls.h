@@ -0,0 +1,68 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/08
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include "options.h"
+
+struct mg_connection;
+
+namespace mg {
+
+/// TLS credentials parsed once and referenced by any number of connections
+/// and servers through Options::tls. Safe to share across loops.
+class TlsContext {
+ public:
+  using Ptr = std::shared_ptr<TlsContext>;
+
+  /// ca, cert and key hold PEM/DER content or packed fs paths
+  TlsContext(std::string ca, std::string cert, std::string key);
+  template <class T>
+  explicit TlsContext(const Options<T>& options)
+      : TlsContext(options.ca, options.cert, options.key) {}
+
+  /// Swap in new credentials for handshakes started from now on, live
+  /// sessions keep the old ones. False leaves the current ones in place.
+  bool Reload(std::string ca, std::string cert, std::string key);
+  /// Credentials parsed and held as a shared context
+  bool Shared() const;
+  /// Start TLS on c, name is the SNI and verified host name
+  void Init(struct mg_connection* c, std::string_view name) const;
+
+ private:
+  struct Creds {
+    std::string ca;
+    std::string cert;
+    std::string key;
+    std::shared_ptr<void> ctx;  // mg_tls_shared_new, null if unsupported
+  };
+  static std::shared_ptr<const Creds> Parse(std::string ca, std::string cert,
+                                            std::string key);
+
+ private:
+  mutable std::mutex mtx_;
+  std::shared_ptr<const Creds> creds_;
+};
+
+}  // namespace mg
@@ -0,0 +1,151 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/18
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "chunked.h"
+#include "mongoose.h"
+
+namespace mg {
+
+/// Length of the line at buf including its CRLF, 0 if incomplete
+static size_t LineLen(const char* buf, size_t len) {
+  auto* lf = static_cast<const char*>(memchr(buf, '\n', len));
+  return lf ? static_cast<size_t>(lf - buf) + 1 : 0;
+}
+
+long ChunkedDecoder::Skip(const char* buf, size_t len) {
+  size_t ofs = 0;
+  while (ofs < len && state_ != kData && state_ != kDone) {
+    const char* p = buf + ofs;
+    size_t n = len - ofs;
+    if (state_ == kDataEnd) {
+      if (n < 2)
+        break;
+      if (p[0] != '\r' || p[1] != '\n')
+        return -1;
+      ofs += 2;
+      state_ = kSize;
+      continue;
+    }
+    size_t line = LineLen(p, n < kMaxLine ? n : kMaxLine);
+    if (line == 0) {
+      if (n >= kMaxLine)
+        return -1;
+      break;  // wait for the rest of the line
+    }
+    ofs += line;
+    if (state_ == kTrailer) {
+      if (line <= 2)
+        state_ = kDone;  // empty line ends the trailers
+      continue;
+    }
+    size_t size = 0, digits = 0;
+    for (; digits < line; digits++) {
+      char ch = p[digits];
+      int v = ch >= '0' && ch <= '9'   ? ch - '0'
+              : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10
+              : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10
+                                       : -1;
+      if (v < 0)
+        break;
+      if (size > (static_cast<size_t>(-1) >> 4))
+        return -1;  // overflow
+      size = size * 16 + v;
+    }
+    if (digits == 0)
+      return -1;
+    remaining_ = size;
+    state_ = size ? kData : kTrailer;
+  }
+  return static_cast<long>(ofs);
+}
+
+void ChunkedDecoder::Consume(size_t n) {
+  remaining_ -= n;
+  if (remaining_ == 0)
+    state_ = kDataEnd;
+}
+
+BodyStream::Status BodyStream::Feed(struct mg_connection* c,
+                                    const Writer& write) {
+  fed_ = 0;
+  for (;;) {
+    size_t avail;
+    if (framing_ == kChunked) {
+      long skip = decoder_.Skip((char*)c->recv.buf, c->recv.len);
+      if (skip < 0)
+        return kMalformed;
+      mg_iobuf_del(&c->recv, 0, static_cast<size_t>(skip));
+      if (decoder_.Done())
+        return kDone;
+      avail = std::min(c->recv.len, decoder_.Pending());
+    } else if (framing_ == kUntilClose) {
+      avail = c->recv.len;
+    } else {
+      if (remaining_ == 0)
+        return kDone;
+      avail = std::min(c->recv.len, remaining_);
+    }
+    if (avail == 0) {
+      c->is_full = 0;  // everything taken, read more
+      StopRetry(c);
+      return kMore;
+    }
+    long n = write(std::string_view((char*)c->recv.buf, avail));
+    if (n < 0)
+      return kAborted;
+    fed_ += static_cast<size_t>(n);
+    if (framing_ == kChunked) {
+      decoder_.Consume(static_cast<size_t>(n));
+    } else if (framing_ == kLength) {
+      remaining_ -= static_cast<size_t>(n);
+    }
+    mg_iobuf_del(&c->recv, 0, static_cast<size_t>(n));
+    if (static_cast<size_t>(n) < avail) {
+      c->is_full = 1;  // leave the rest in the socket buffer
+      if (timer_ == nullptr) {
+        /// keep MG_EV_POLL coming while nothing is read
+        timer_ = mg_timer_add(c->mgr, kRetryMs, MG_TIMER_REPEAT,
+                              [](void* arg) {
+                                mg_mark(static_cast<mg_connection*>(arg));
+                              },
+                              c);
+      }
+      return kMore;
+    }
+  }
+}
+
+void BodyStream::Stop(struct mg_connection* c) {
+  StopRetry(c);
+  c->is_full = 0;
+}
+
+void BodyStream::StopRetry(struct mg_connection* c) {
+  if (timer_) {
+    mg_timer_free(&c->mgr->timers, timer_);
+    mg_free(timer_);
+    timer_ = nullptr;
+  }
+}
+
+}  // namespace mg
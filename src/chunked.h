@@ -0,0 +1,88 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/18
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+struct mg_connection;
+struct mg_timer;
+
+namespace mg {
+
+/// Incremental Transfer-Encoding: chunked decoder working in place on a
+/// receive buffer. Skip() eats framing, then Pending() body bytes at the
+/// front of the buffer are data, consumed in any steps through Consume().
+class ChunkedDecoder {
+ public:
+  /// Framing bytes at the front of buf to drop, -1 when malformed. Stops at
+  /// chunk data, at the end of the body, or when more input is needed.
+  long Skip(const char* buf, size_t len);
+  /// Data bytes of the current chunk left to consume
+  size_t Pending() const { return state_ == kData ? remaining_ : 0; }
+  void Consume(size_t n);
+  /// Last chunk and trailers seen
+  bool Done() const { return state_ == kDone; }
+
+ private:
+  static constexpr size_t kMaxLine = 4096;  // size line or trailer field
+  enum State { kSize, kData, kDataEnd, kTrailer, kDone };
+  State state_ = kSize;
+  size_t remaining_ = 0;
+};
+
+/// Message body streamed out of a connection's receive buffer, shared by
+/// server uploads and client downloads while http_cb is detached. Bytes
+/// the writer refuses stay in the socket buffer: reading stops and a timer
+/// offers them again until taken.
+class BodyStream {
+ public:
+  static constexpr uint64_t kRetryMs = 5;  // writer full, offer the rest again
+  enum Framing { kLength, kChunked, kUntilClose };
+  enum Status { kMore, kDone, kMalformed, kAborted };
+  /// Takes body bytes, returns how many it took or -1 to abort
+  using Writer = std::function<long(std::string_view)>;
+
+  explicit BodyStream(Framing framing = kLength, size_t length = 0)
+      : framing_(framing), remaining_(length) {}
+
+  /// Hand received bytes to write until it refuses some, the input runs out
+  /// or the body is complete, run on MG_EV_READ and MG_EV_POLL
+  Status Feed(struct mg_connection* c, const Writer& write);
+  /// Resume reading and drop the retry timer, before the stream goes away
+  void Stop(struct mg_connection* c);
+  /// Bytes taken by the last Feed
+  size_t Fed() const { return fed_; }
+  bool UntilClose() const { return framing_ == kUntilClose; }
+
+ private:
+  void StopRetry(struct mg_connection* c);
+
+  Framing framing_;
+  size_t remaining_;  // kLength bytes left
+  ChunkedDecoder decoder_;
+  size_t fed_ = 0;
+  struct mg_timer* timer_ = nullptr;
+};
+
+}  // namespace mg
@@ -19,19 +19,39 @@
  * limitations under the License.
  */
 
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <vector>
 #include "client.h"
 #include "common.h"
 
 namespace mg {
 
-bool IClient::Add(IConnect::Ptr conn) {
+IConnect::Ptr IClient::Attach(IConnect::Ptr conn) {
+  conn->client_ = this;
+  conn->handle_ = handle_;
+  conn->on_release = [this](IConnect::Ptr c) { this->Remove(c); };
+  if (Add(conn))
+    return conn;
+  return nullptr;
+}
+
+size_t IClient::Size() {
   std::lock_guard<std::mutex> guard(mtx_);
-  auto ret = sess_set_.emplace(conn);
-  if (ret.second) {
+  return sess_set_.size();
+}
+
+bool IClient::Add(IConnect::Ptr conn) {
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    auto ret = sess_set_.emplace(conn);
+    if (!ret.second)
+      return false;
     sess_queue_.push(ret.first->get());
-    return true;
   }
-  return false;
+  Wakeup();
+  return true;
 }
 
 bool IClient::Remove(IConnect::Ptr conn)
@@ -41,27 +61,123 @@ bool IClient::Remove(IConnect::Ptr conn)
   return r > 0 ? true : false;
 }
 
-IConnect* IClient::Pop() {
+std::queue<IConnect*> IClient::Pop() {
   std::lock_guard<std::mutex> guard(mtx_);
-  IConnect* p = nullptr;
-  if (!sess_queue_.empty()) {
-    p = sess_queue_.front();
-    sess_queue_.pop();
+  std::queue<IConnect*> q;
+  q.swap(sess_queue_);
+  return q;
+}
+
+void IClient::Post(Outbound out) {
+  outbox_.Push(std::move(out));
+  Wakeup();
+}
+
+void IClient::Dispatch() {
+  /// MQTT fixed header, topic length and packet id
+  constexpr size_t kFrameOverhead = 16;
+  std::vector<Outbound> batch;
+  std::unordered_map<IConnect*, size_t> sizes;
+  for (Outbound out; outbox_.Pop(out);) {
+    if (out.kill) {
+      out.conn->End();
+      continue;
+    }
+    if (out.conn->mgc_ == nullptr && !out.conn->Reconnecting()) {
+      LOGE("dropped %lu bytes posted to closed %.*s",
+           (unsigned long)out.data.size(), (int)out.conn->Url().size(),
+           out.conn->Url().data());
+      continue;
+    }
+    size_t size = out.data.size();
+    if (!out.topic.empty())
+      size += out.topic.size() + kFrameOverhead;
+    sizes[out.conn.get()] += size;
+    batch.emplace_back(std::move(out));
   }
-  return p;
+  /// one send buffer growth per connection, the writes then only copy
+  for (auto& [conn, size] : sizes)
+    conn->Reserve(size);
+  for (auto& out : batch)
+    out.conn->Write(out);
 }
 
 bool IClient::EventLoop() {
-  if (IConnect* p = Pop(); p)
-    p->Init(&mgr_);
+  for (auto q = Pop(); !q.empty(); q.pop())
+    q.front()->Init(&mgr_);
 
-  mg_mgr_poll(&mgr_, 50);
+  Dispatch();
   if (Stopped()) {
-    if (mgr_.conns == NULL)
-      return false;  // exit loop
-    Flush();
+    pool_.Shutdown();
+    /// connections between reconnects have no socket to drain, end them
+    std::vector<IConnect::Ptr> waiting;
+    {
+      std::lock_guard<std::mutex> guard(mtx_);
+      for (auto& conn : sess_set_) {
+        if (conn->Reconnecting())
+          waiting.push_back(conn);
+      }
+    }
+    for (auto& conn : waiting)
+      conn->End();
   }
-  return true;
+  return Poll();
+}
+
+static Placer MakePlacer(Placement placement) {
+  switch (placement) {
+    case Placement::kLeastConnections:
+      return [](std::string_view, const auto& loops) {
+        size_t idx = 0, least = loops[0]->Size();
+        for (size_t i = 1; i < loops.size() && least > 0; i++) {
+          if (size_t n = loops[i]->Size(); n < least) {
+            idx = i;
+            least = n;
+          }
+        }
+        return idx;
+      };
+    case Placement::kHashHost:
+      return [](std::string_view url, const auto& loops) {
+        std::string u(url);
+        struct mg_str host = mg_url_host(u.c_str());
+        size_t h = std::hash<std::string_view>{}(
+            std::string_view(host.buf, host.len));
+        h ^= std::hash<unsigned short>{}(mg_url_port(u.c_str())) + (h << 6);
+        return h % loops.size();
+      };
+    case Placement::kRoundRobin:
+    default:
+      return [next = std::make_shared<std::atomic<size_t>>(0)](
+                 std::string_view, const auto& loops) {
+        return next->fetch_add(1, std::memory_order_relaxed) % loops.size();
+      };
+  }
+}
+
+IClientPool::IClientPool(size_t threads, Placement placement,
+                         const SlabOptions& slab)
+    : IClientPool(threads, MakePlacer(placement), slab) {}
+
+IClientPool::IClientPool(size_t threads, Placer placer,
+                         const SlabOptions& slab)
+    : placer_(std::move(placer)) {
+  threads = threads ? threads : 1;
+  for (size_t i = 0; i < threads; i++) {
+    loops_.emplace_back(std::make_unique<IClient>(HttpPoolOptions(), slab));
+  }
+}
+
+SlabStats IClientPool::MemoryStats() const {
+  SlabStats stats;
+  for (auto& loop : loops_)
+    stats += loop->MemoryStats();
+  return stats;
+}
+
+size_t IClientPool::Place(std::string_view url) {
+  size_t idx = placer_ ? placer_(url, loops_) : 0;
+  return idx < loops_.size() ? idx : idx % loops_.size();
 }
 
 }  // namespace mg
\ No newline at end of file
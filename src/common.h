@@ -20,7 +20,9 @@
  */
 #pragma once
 
+#include <algorithm>
 #include "mongoose.h"
+#include "options.h"
 
 #define MG_EV_USER_READY MG_EV_USER + 100
 
@@ -35,4 +37,56 @@
 #endif
 #ifndef LOGD
 #define LOGD(...) MG_DEBUG((__VA_ARGS__))
-#endif
\ No newline at end of file
+#endif
+
+namespace mg {
+
+/// Point fields at the parsed headers of hm, no copies
+inline HttpHeaderView ViewHeaders(struct mg_http_message* hm,
+                                  HttpHeaderView::Field* fields) {
+  size_t n = 0;
+  for (; n < MG_MAX_HTTP_HEADERS && hm->headers[n].name.len > 0; n++) {
+    fields[n] = {std::string_view(hm->headers[n].name.buf,
+                                  hm->headers[n].name.len),
+                 std::string_view(hm->headers[n].value.buf,
+                                  hm->headers[n].value.len)};
+  }
+  return HttpHeaderView(fields, n);
+}
+
+/// Set up the buffers of a connection just opened
+inline void ApplyBuffers(struct mg_connection* c, const BufferOptions& b) {
+  if (c->is_listening)
+    return;
+  if (b.step > 0)
+    c->recv.align = c->send.align = b.step;
+  /// growth 0 fits the send buffer to every write, dropping the capacity
+  uint8_t growth = b.growth > 0 || b.initial > 0 ? std::max<uint8_t>(b.growth, 1)
+                                                 : 0;
+  c->recv.growth = c->send.growth = growth;
+  c->max_recv = b.max_recv;
+  if (b.initial > 0) {
+    mg_iobuf_resize(&c->recv, b.initial);
+    mg_iobuf_resize(&c->send, b.initial);
+  }
+}
+
+/// Report the send buffer crossing the watermarks of o, run on MG_EV_POLL
+/// and MG_EV_WRITE
+template <class T>
+inline void CheckWatermarks(typename WatermarkTarget<T>::Type* target,
+                            struct mg_connection* c, const Options<T>& o) {
+  const BufferOptions& b = o.buffers;
+  if (b.send_high == 0 || !o.on_watermark)
+    return;
+  size_t pending = c->send.len + c->sendfile_len;
+  if (!c->is_send_high && pending > b.send_high) {
+    c->is_send_high = 1;
+    o.on_watermark(target, true);
+  } else if (c->is_send_high && pending <= b.send_low) {
+    c->is_send_high = 0;
+    o.on_watermark(target, false);
+  }
+}
+
+}  // namespace mg
@@ -19,12 +19,22 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "chunked.h"
+#include "client.h"
 #include "connect.h"
+#include "mqttinflight.h"
+#include "mqtttrie.h"
 
 namespace mg {
 
 void IConnect::Timeout(void* fn_data) {
   auto* conn = static_cast<IConnect*>(fn_data);
+  conn->timer_ = nullptr;  // one-shot, mongoose frees it after this call
   conn->OnTimeout();
 }
 
@@ -36,32 +46,68 @@ void IConnect::Callback(struct mg_connection* c, int ev, void* ev_data) {
   }
 }
 
-static HttpHeaders ReverseParseHeaders(struct mg_http_message* hm) {
-  HttpHeaders headers;
-  for (size_t i = 0; i < MG_MAX_HTTP_HEADERS && hm->headers[i].name.len > 0;
-       i++) {
-    headers.emplace(
-        std::string(hm->headers[i].name.buf, hm->headers[i].name.len),
-        std::string(hm->headers[i].value.buf, hm->headers[i].value.len));
-  }
-  return headers;
+bool IConnect::Send(std::string_view body) {
+  return mgc_ && mg_send(mgc_, body.data(), body.size());
 }
 
-bool IConnect::Send(std::string_view body) {
-  return mg_send(mgc_, body.data(), body.size());
+bool IConnect::SendAsync(std::string body) {
+  return Post({.conn = shared_from_this(), .data = std::move(body)});
+}
+
+bool IConnect::Post(Outbound out) {
+  if (!handle_)
+    return false;
+  std::shared_lock<std::shared_mutex> lock(handle_->mtx);
+  if (!handle_->loop)
+    return false;
+  handle_->loop->Post(std::move(out));
+  return true;
+}
+
+void IConnect::Write(const Outbound& out) {
+  if (mgc_)
+    mg_send(mgc_, out.data.data(), out.data.size());
+}
+
+void IConnect::Reserve(size_t size) {
+  if (mgc_ && mgc_->send.size < mgc_->send.len + size) {
+    mg_iobuf_resize(&mgc_->send, mgc_->send.len + size);
+  }
 }
 
 bool IConnect::kill() {
+  return Post({.conn = shared_from_this(), .kill = true});
+}
+
+bool IConnect::End() {
   if (!mgc_)
     return false;
   mgc_->is_draining = 1;
+  mg_mark(mgc_);
   return true;
 }
 
 void IConnect::StartTimer(uint64_t period_ms, unsigned flags) {
-  mg_timer_add(mgr_, period_ms, flags, &IConnect::Timeout, this);
+  StopTimer();
+  timer_ = mg_timer_add(mgr_, period_ms, flags, &IConnect::Timeout, this);
+}
+
+void IConnect::StopTimer() {
+  if (timer_) {
+    mg_timer_free(&mgr_->timers, timer_);
+    mg_free(timer_);
+    timer_ = nullptr;
+  }
 }
 
+/// Response body being streamed, http_cb is detached meanwhile
+struct HttpConnect::Download {
+  int fd = -1;             // options_.download
+  mg_event_handler_t pfn;  // http_cb, back once the body is in
+  BodyStream body;         // until close when neither length nor chunked
+  bool reuse = false;      // back to the pool once complete
+};
+
 HttpConnect::HttpConnect(HttpConnectOptions options)
     : TcpConnect<HttpConnectOptions>(std::move(options)) {
   if (!options_.file.empty()) {
@@ -70,6 +116,7 @@ HttpConnect::HttpConnect(HttpConnectOptions options)
       time_t tm;
       size_t fs;
       mgfd_->fs->st(options_.file.c_str(), &fs, &tm);
+      upload_size_ = fs;
       options_.headers.emplace(
           std::make_pair("Content-Type", "application/octet-stream"));
       options_.headers.emplace(
@@ -78,73 +125,380 @@ HttpConnect::HttpConnect(HttpConnectOptions options)
   }
 }
 
+HttpConnect::~HttpConnect() {
+  if (download_ && download_->fd >= 0)
+    close(download_->fd);
+}
+
 void HttpConnect::Handler(int ev, void* ev_data) {
+  if (download_ && (ev == MG_EV_READ || ev == MG_EV_POLL)) {
+    Feed();  // may hand the connection back to the pool
+    return;
+  }
   if (ev == MG_EV_USER_READY && !options_.on_ready) {
     Request();
-  } else if (ev == MG_EV_HTTP_MSG && options_.on_message) {
+  } else if (ev == MG_EV_HTTP_HDRS) {
+    answered_ = true;
+    if (!options_.download.empty() || options_.on_chunk)
+      StartDownload(static_cast<struct mg_http_message*>(ev_data));
+  } else if (ev == MG_EV_HTTP_MSG) {
     auto* hm = static_cast<struct mg_http_message*>(ev_data);
-    HttpMessage msg = {.status = mg_http_status(hm),
-                       .headers = ReverseParseHeaders(hm)};
-    msg.body = std::string_view(hm->body.buf, hm->body.len);
-    options_.on_message(this, std::move(msg));
-  } else if (ev == MG_EV_WRITE && mgfd_ != nullptr) {
-    char buf[MG_IO_SIZE];
-    size_t len = MG_IO_SIZE - mgc_->send.len;
-    size_t rlen = mgfd_->fs->rd(mgfd_->fd, buf, len);
-    if (rlen) {
-      mg_send(mgc_, buf, rlen);
-      LOGI("post size=%u", rlen);
-    } else {
-      mg_fs_close(mgfd_);
-      mgfd_ = nullptr;
+    if (options_.on_message) {
+      HttpHeaderView::Field fields[MG_MAX_HTTP_HEADERS];
+      HttpMessage msg = {.status = mg_http_status(hm),
+                         .headers = ViewHeaders(hm, fields)};
+      msg.body = std::string_view(hm->body.buf, hm->body.len);
+      options_.on_message(this, std::move(msg));
+    }
+    if (!pool_key_.empty() && Reusable(hm)) {
+      /// request done, the connection goes back to the pool
+      auto self = shared_from_this();
+      auto* c = mgc_;
+      Finish();
+      client_->Pool().Release(pool_key_, c);
+      return;
     }
+  } else if (ev == MG_EV_WRITE && mgfd_ != nullptr) {
+    Upload();
   } else if (ev == MG_EV_CLOSE) {
-    if (mgfd_) {
-      mg_fs_close(mgfd_);
+    CloseUpload();
+    if (download_) {
+      if (download_->body.UntilClose())
+        Feed();
+      if (download_)
+        EndDownload(download_->body.UntilClose() && mgc_->recv.len == 0);
+    }
+    if (!pool_key_.empty()) {
+      client_->Pool().Closed(pool_key_);
+      if (reused_ && !answered_ && options_.file.empty()) {
+        /// server dropped the idle connection under us, retry once fresh
+        LOGD("stale keep-alive connection to %s", pool_key_.c_str());
+        StopTimer();
+        mgc_ = nullptr;
+        reused_ = false;
+        Init(mgr_);
+        return;
+      }
     }
   }
   TcpConnect<HttpConnectOptions>::Handler(ev, ev_data);
 }
 
+void HttpConnect::Upload() {
+  auto* c = static_cast<struct mg_connection*>(mgc_);
+  if (sendfile_) {
+    if (c->sendfile_len == 0) {
+      LOGD("post size=%lu done", (unsigned long)upload_size_);
+      CloseUpload();
+    }
+    return;
+  }
+  /// plain TCP: the kernel streams the file, no copies through user space
+  int fd = fileno(static_cast<FILE*>(mgfd_->fd));
+  if (upload_size_ > 0 && mg_sendfile(c, fd, 0, upload_size_)) {
+    sendfile_ = true;
+    return;
+  }
+  /// TLS: read straight into the send buffer, large writes make full records
+  if (c->send.len >= kUploadChunk)
+    return;
+  if (c->send.size < kUploadChunk &&
+      !mg_iobuf_resize(&c->send, kUploadChunk)) {
+    mg_error(c, "OOM");
+    return;
+  }
+  size_t len = mgfd_->fs->rd(mgfd_->fd, c->send.buf + c->send.len,
+                             c->send.size - c->send.len);
+  if (len) {
+    c->send.len += len;
+  } else {
+    CloseUpload();
+  }
+}
+
+void HttpConnect::CloseUpload() {
+  if (mgfd_) {
+    mg_fs_close(mgfd_);
+    mgfd_ = nullptr;
+  }
+}
+
 void HttpConnect::Init(struct mg_mgr* mgr) {
   mgr_ = mgr;
+  if (options_.keep_alive && client_) {
+    auto& pool = client_->Pool();
+    pool_key_ = HttpConnPool::Key(options_.url);
+    if (auto* c = pool.Acquire(pool_key_); c) {
+      Adopt(c);
+      return;
+    }
+    if (!pool.Open(pool_key_)) {
+      pool.Wait(pool_key_,
+                std::static_pointer_cast<HttpConnect>(shared_from_this()));
+      return;
+    }
+  }
   mgc_ = mg_http_connect(mgr, options_.url.c_str(), &IConnect::Callback,
                          static_cast<void*>(this));
+  if (!mgc_ && !pool_key_.empty()) {
+    client_->Pool().Closed(pool_key_);
+  }
+}
+
+void HttpConnect::Adopt(struct mg_connection* c) {
+  mgc_ = c;
+  reused_ = true;
+  answered_ = false;
+  c->fn = &IConnect::Callback;
+  c->fn_data = static_cast<void*>(this);
+  if (options_.timeout) {
+    StartTimer(options_.timeout, MG_TIMER_ONCE);
+  }
+  mg_call(c, MG_EV_USER_READY, this);
+}
+
+void HttpConnect::Abort(std::string_view cause) {
+  auto self = shared_from_this();
+  cause_ = cause;
+  Finish();
+}
+
+bool HttpConnect::Reusable(struct mg_http_message* hm) const {
+  if (!mgc_ || mgfd_ || mgc_->is_draining || mgc_->is_closing)
+    return false;
+  /// for a response mongoose parses the version into method
+  if (mg_strcasecmp(hm->method, mg_str("HTTP/1.1")) != 0)
+    return false;
+  auto* conn = mg_http_get_header(hm, "Connection");
+  return conn == nullptr || mg_strcasecmp(*conn, mg_str("close")) != 0;
+}
+
+/// Take the response over from http_cb once its headers are in
+void HttpConnect::StartDownload(struct mg_http_message* hm) {
+  auto* c = mgc_;
+  int status = mg_http_status(hm);
+  if (status >= 100 && status < 200)
+    return;  // interim, the final response follows
+  auto d = std::make_unique<Download>();
+  if (!options_.download.empty()) {
+    d->fd = open(options_.download.c_str(),
+                 O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (d->fd < 0) {
+      mg_error(c, "download open %s: %d", options_.download.c_str(), errno);
+      c->recv.len = 0;  // no on_message either
+      return;
+    }
+  }
+  struct mg_str* te = mg_http_get_header(hm, "Transfer-Encoding");
+  if (options_.method == "HEAD" || status == 204 || status == 304) {
+    // no body
+  } else if (te && mg_strcasecmp(*te, mg_str("chunked")) == 0) {
+    d->body = BodyStream(BodyStream::kChunked);
+  } else if (mg_http_get_header(hm, "Content-Length")) {
+    d->body = BodyStream(BodyStream::kLength, hm->body.len);
+  } else {
+    d->body = BodyStream(BodyStream::kUntilClose);
+  }
+  d->reuse = !pool_key_.empty() && !d->body.UntilClose() && Reusable(hm);
+  d->pfn = c->pfn;
+  if (options_.on_headers) {
+    HttpHeaderView::Field fields[MG_MAX_HTTP_HEADERS];
+    options_.on_headers(this, HttpMessage{.status = status,
+                                          .headers = ViewHeaders(hm, fields)});
+  }
+  download_ = std::move(d);
+  /// changing recv detaches http_cb, the body is fed from MG_EV_READ
+  mg_iobuf_del(&c->recv, 0,
+               static_cast<size_t>(hm->head.buf - (char*)c->recv.buf) +
+                   hm->head.len);
+}
+
+/// Hand received body bytes on, reading stops while they are refused
+void HttpConnect::Feed() {
+  auto* c = mgc_;
+  auto status = download_->body.Feed(
+      c, [this](std::string_view data) { return Deliver(data); });
+  switch (status) {
+    case BodyStream::kMore:
+      if (!c->is_full && download_->body.Fed() > 0 && options_.timeout)
+        StartTimer(options_.timeout, MG_TIMER_ONCE);
+      return;
+    case BodyStream::kDone:
+      EndDownload(true);
+      return;
+    case BodyStream::kMalformed:
+      mg_error(c, "Invalid chunk");
+      return;
+    case BodyStream::kAborted:
+      mg_error(c, "download aborted");
+      return;
+  }
+}
+
+long HttpConnect::Deliver(std::string_view chunk) {
+  int fd = download_->fd;
+  if (fd < 0)
+    return options_.on_chunk(this, chunk);
+  size_t n = 0;
+  while (n < chunk.size()) {
+    ssize_t r = write(fd, chunk.data() + n, chunk.size() - n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0) {
+      LOGE("download write %s: %d", options_.download.c_str(), errno);
+      return -1;
+    }
+    n += r;
+  }
+  return static_cast<long>(n);
+}
+
+void HttpConnect::EndDownload(bool complete) {
+  auto d = std::move(download_);
+  auto* c = mgc_;
+  d->body.Stop(c);
+  if (d->fd >= 0 && close(d->fd) != 0)
+    complete = false;
+  if (!complete) {
+    if (d->fd >= 0)
+      unlink(options_.download.c_str());
+    if (cause_ == "normal")
+      cause_ = "download incomplete";
+    return;
+  }
+  if (d->fd < 0)
+    options_.on_chunk(this, std::string_view());
+  c->pfn = d->pfn;
+  if (d->reuse && !c->is_draining && !c->is_closing) {
+    /// request done, the connection goes back to the pool
+    auto self = shared_from_this();
+    Finish();
+    client_->Pool().Release(pool_key_, c);
+  } else {
+    c->is_draining = 1;  // body complete, on_close reports it
+  }
+}
+
+/// Walk the pieces of a request head in wire order, sink sees each once
+template <class Sink>
+static void WalkHead(Sink&& sink, std::string_view method,
+                     std::string_view uri, std::string_view host,
+                     const HttpHeaders& headers, bool keep_alive) {
+  sink(method);
+  sink(" ");
+  sink(uri);
+  sink(keep_alive ? " HTTP/1.1\r\nHost: " : " HTTP/1.0\r\nHost: ");
+  sink(host);
+  sink("\r\n");
+  for (const auto& [key, value] : headers) {
+    sink(key);
+    sink(": ");
+    sink(value);
+    sink("\r\n");
+  }
+  sink("\r\n");
+}
+
+template <class... Args>
+static size_t HeadSize(const Args&... args) {
+  size_t size = 0;
+  WalkHead([&](std::string_view s) { size += s.size(); }, args...);
+  return size;
+}
+
+/// Copy the head to out, which has room for HeadSize() bytes
+template <class... Args>
+static void RenderHead(char* out, const Args&... args) {
+  WalkHead([&](std::string_view s) {
+    memcpy(out, s.data(), s.size());
+    out += s.size();
+  }, args...);
+}
+
+HttpRequestTemplate::Ptr HttpRequestTemplate::Create(
+    const HttpConnectOptions& options) {
+  auto tmpl = std::make_shared<HttpRequestTemplate>();
+  struct mg_str host = mg_url_host(options.url.c_str());
+  std::string_view uri = mg_url_uri(options.url.c_str());
+  std::string_view hv(host.buf, host.len);
+  tmpl->head_.resize(HeadSize(options.method, uri, hv, options.headers,
+                              options.keep_alive));
+  RenderHead(tmpl->head_.data(), options.method, uri, hv, options.headers,
+             options.keep_alive);
+  tmpl->version_ = options.method.size() + 1 + uri.size() + 8;
+  tmpl->typed_ = options.headers.count("Content-Type") > 0;
+  return tmpl;
 }
 
 void HttpConnect::Request() {
   auto* c = static_cast<struct mg_connection*>(mgc_);
-  struct mg_str host = mg_url_host(options_.url.c_str());
-  const char* uri = mg_url_uri(options_.url.c_str());
-  auto hstr = ParseHeaders();
-  mg_printf(c,
-            "%s %s HTTP/1.0\r\n"  // method uri
-            "Host: %.*s\r\n"      // host
-            "%s"                  // other headers
-            "\r\n",
-            options_.method.c_str(), uri, (int)host.len, host.buf,
-            hstr.c_str());
+  if (options_.request_template) {
+    auto& tmpl = *options_.request_template;
+    size_t ofs = c->send.len;
+    /// the blank line goes after the headers of this request
+    if (!mg_send(c, tmpl.head_.data(), tmpl.head_.size() - 2)) {
+      mg_error(c, "OOM");
+      return;
+    }
+    c->send.buf[ofs + tmpl.version_] = options_.keep_alive ? '1' : '0';
+    if (mgfd_) {
+      if (!tmpl.typed_)
+        mg_printf(c, "Content-Type: application/octet-stream\r\n");
+      mg_printf(c, "Content-Length: %lu\r\n", (unsigned long)upload_size_);
+    }
+    mg_send(c, "\r\n", 2);
+  } else {
+    struct mg_str host = mg_url_host(options_.url.c_str());
+    std::string_view uri = mg_url_uri(options_.url.c_str());
+    std::string_view hv(host.buf, host.len);
+    size_t size = HeadSize(options_.method, uri, hv, options_.headers,
+                           options_.keep_alive);
+    /// one growth of the send buffer for head and body, then a plain copy
+    size_t want = c->send.len + size + options_.body.size();
+    if (c->send.size < want && !mg_iobuf_resize(&c->send, want)) {
+      mg_error(c, "OOM");
+      return;
+    }
+    RenderHead(reinterpret_cast<char*>(c->send.buf + c->send.len),
+               options_.method, uri, hv, options_.headers,
+               options_.keep_alive);
+    c->send.len += size;
+    mg_mark(c);  // a pooled connection may be adopted outside its dispatch
+  }
   if (!options_.body.empty()) {
     IConnect::Send(options_.body);
   }
 }
 
-std::string HttpConnect::ParseHeaders() {
-  std::string hstr;
-  for (const auto& [key, value] : options_.headers) {
-    hstr += key + ": " + value + "\r\n";
+MqttConnect::MqttConnect(MqttConnectOptions options)
+    : TcpConnect<MqttConnectOptions>(std::move(options)),
+      inflight_(std::make_unique<MqttInflight>(options_.max_inflight,
+                                               options_.max_queued)),
+      routes_(std::make_unique<Routes>()) {
+  for (auto& [filter, handler] : options_.handlers) {
+    if (handler && routes_->Insert(filter, handler)) {
+      Track(filter);
+    } else {
+      LOGE("bad topic filter %s", filter.c_str());
+    }
+  }
+  for (auto& topic : options_.topics) {
+    if (Routes::Valid(topic)) {
+      Track(topic);
+    } else {
+      LOGE("bad topic filter %s", topic.c_str());
+    }
   }
-  return hstr;
 }
 
-MqttConnect::MqttConnect(MqttConnectOptions options)
-    : TcpConnect<MqttConnectOptions>(std::move(options)) {}
+MqttConnect::~MqttConnect() = default;
 
 void MqttConnect::Init(struct mg_mgr* mgr) {
   struct mg_mqtt_opts opts = {
       .user = mg_str(options_.user.c_str()),
       .pass = mg_str(options_.pass.c_str()),
       .qos = options_.qos,
+      .version = options_.version,
   };
   mgr_ = mgr;
   mgc_ = mg_mqtt_connect(mgr, options_.url.c_str(), &opts, &IConnect::Callback,
@@ -154,61 +508,351 @@ void MqttConnect::Init(struct mg_mgr* mgr) {
 void MqttConnect::Handler(int ev, void* ev_data) {
   auto* c = static_cast<struct mg_connection*>(mgc_);
   if (ev == MG_EV_MQTT_OPEN) {
-    struct mg_mqtt_opts opt = {
-        .user = mg_str(options_.user.c_str()),
-        .pass = mg_str(options_.pass.c_str()),
-        .qos = options_.qos,
-    };
-    for (const auto& topic : options_.topics) {
-      opt.topic = mg_str(topic.c_str());
-      mg_mqtt_sub(c, &opt);
-    }
+    session_ = *static_cast<uint8_t*>(ev_data) == 0;
+    if (session_ && !filters_.empty())
+      SendSubscribe(filters_.data(), filters_.size());
     if (options_.on_mqtt_open) {
       options_.on_mqtt_open(this);
     }
-  } else if (ev == MG_EV_MQTT_MSG && options_.on_message) {
+  } else if (ev == MG_EV_MQTT_MSG) {
     struct mg_mqtt_message* mm = (struct mg_mqtt_message*)ev_data;
     MqttMessage msg = {.topic = std::string_view(mm->topic.buf, mm->topic.len)};
     msg.body = std::string_view(mm->data.buf, mm->data.len);
-    options_.on_message(this, std::move(msg));
+    msg.retain = mm->dgram.buf[0] & 1;
+    Dispatch(msg);
+  } else if (ev == MG_EV_MQTT_CMD) {
+    struct mg_mqtt_message* mm = (struct mg_mqtt_message*)ev_data;
+    switch (mm->cmd) {
+      case MQTT_CMD_CONNACK:  // after MG_EV_MQTT_OPEN
+        if (mm->ack == 0)
+          Resume(mm);
+        break;
+      case MQTT_CMD_PUBACK:
+      case MQTT_CMD_PUBREC:
+      case MQTT_CMD_PUBCOMP:
+        if (inflight_->Ack(mm->cmd, mm->id) && open_)
+          inflight_->Pump(c);
+        break;
+      default:
+        break;
+    }
+  } else if (ev == MG_EV_CLOSE) {
+    open_ = session_ = false;  // the window is kept for the next session
+    StopLinger();
+    if (Retry())
+      return;  // held publishes go out on the next session
+    held_.clear();  // QoS 0, no delivery promised
+    holding_ = 0;
   }
   TcpConnect<MqttConnectOptions>::Handler(ev, ev_data);
 }
 
+bool MqttConnect::Retry() {
+  const auto& r = options_.reconnect;
+  if (!r.enable || stopped_ || (client_ && client_->Stopped()))
+    return false;
+  if (r.max_attempts && attempts_ >= r.max_attempts) {
+    LOGE("mqtt %s: giving up after %u attempts", options_.url.c_str(),
+         attempts_);
+    return false;
+  }
+  uint32_t rnd = 0;
+  mg_random(&rnd, sizeof(rnd));
+  uint64_t delay = Backoff(r, attempts_, rnd);
+  attempts_++;
+  LOGI("mqtt %s: %s, reconnecting in %llu ms", options_.url.c_str(),
+       cause_.c_str(), (unsigned long long)delay);
+  mgc_ = nullptr;  // freed by mongoose on return
+  waiting_ = true;
+  StartTimer(delay, MG_TIMER_ONCE);
+  return true;
+}
+
+uint64_t MqttConnect::Backoff(const MqttReconnectOptions& r,
+                              uint32_t attempts, uint32_t rnd) {
+  uint64_t ceiling = std::max<uint32_t>(r.min_ms, 1);
+  for (uint32_t i = 0; i < attempts && ceiling < r.max_ms; i++)
+    ceiling *= 2;
+  ceiling = std::min<uint64_t>(ceiling, std::max(r.max_ms, r.min_ms));
+  return ceiling - ceiling / 2 + rnd % (ceiling / 2 + 1);
+}
+
+bool MqttConnect::kill() {
+  stopped_ = true;  // no reconnect from now on, whatever the loop is doing
+  return IConnect::kill();
+}
+
+bool MqttConnect::End() {
+  if (!waiting_)
+    return IConnect::End();
+  auto self = shared_from_this();
+  waiting_ = false;
+  Finish();
+  return true;
+}
+
+void MqttConnect::Resume(struct mg_mqtt_message* mm) {
+  auto* c = static_cast<struct mg_connection*>(mgc_);
+  if (c->is_mqtt5) {
+    // CONNACK: flags, reason code, property length, properties
+    size_t ofs = 1, len = 0;
+    while (ofs < mm->dgram.len && (mm->dgram.buf[ofs++] & 0x80)) {
+    }
+    ofs += 2;
+    const auto* p = reinterpret_cast<const uint8_t*>(mm->dgram.buf);
+    for (size_t shift = 0; ofs < mm->dgram.len; shift += 7) {
+      len |= static_cast<size_t>(p[ofs] & 0x7f) << shift;
+      if (!(p[ofs++] & 0x80))
+        break;
+    }
+    mm->props_start = ofs;
+    mm->props_size = len;
+    struct mg_mqtt_prop prop;
+    for (size_t pos = 0; pos < len && ofs + len <= mm->dgram.len;) {
+      pos = mg_mqtt_next_prop(mm, &prop, pos);
+      if (pos == 0)
+        break;
+      if (prop.id == MQTT_PROP_RECEIVE_MAXIMUM)
+        inflight_->Limit(prop.iv);
+    }
+  }
+  open_ = true;
+  attempts_ = 0;
+  cause_ = "normal";
+  inflight_->Resend(c);
+  Flush();  // publishes made offline, then the queue
+}
+
 void MqttConnect::OnTimeout() {
-  if (mgc_ == nullptr) {
-    Init(mgr_);
-  } else {
-    mg_mqtt_ping(mgc_);
+  if (waiting_) {
+    waiting_ = false;
+    if (!stopped_ && !(client_ && client_->Stopped()))
+      Init(mgr_);
+    if (mgc_ == nullptr && !Retry())
+      Finish();  // this may be gone now
+    return;
   }
-  StartTimer(options_.timeout, MG_TIMER_RUN_NOW);
+  if (mgc_ == nullptr)
+    return;
+  mg_mqtt_ping(mgc_);
+  StartTimer(options_.timeout, MG_TIMER_ONCE);
 }
 
 bool MqttConnect::Publish(MqttMessage msg) {
+  return PublishBatch(&msg, 1) == 1;
+}
+
+size_t MqttConnect::PublishBatch(const MqttMessage* msgs, size_t count) {
   auto* c = static_cast<struct mg_connection*>(mgc_);
+  if ((!c && !waiting_) || count == 0)
+    return 0;
+  uint8_t qos = options_.qos;
+  bool mqtt5 = c ? c->is_mqtt5 : options_.version == 5;
+  bool linger = options_.linger.max_us > 0;
+  size_t taken = 0;
+  if (qos > 0) {  // kept for retransmission, the window writes them
+    for (; taken < count; taken++) {
+      auto& m = msgs[taken];
+      if (!inflight_->Push(
+              MqttInflight::Encode(m.topic, m.body, qos, mqtt5, m.retain)))
+        break;
+    }
+  } else {
+    if (!c)  // offline, held up to max_queued
+      count = std::min(count, options_.max_queued -
+                                  std::min(holding_, options_.max_queued));
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++)
+      bytes += MqttInflight::Size(msgs[i].topic, msgs[i].body, qos, mqtt5);
+    char* out;
+    if (linger || !c) {
+      held_.resize(held_.size() + bytes);
+      out = held_.data() + held_.size() - bytes;
+    } else {
+      size_t ofs = c->send.len;
+      if (mg_iobuf_add(&c->send, ofs, nullptr, bytes) != bytes)
+        return 0;
+      out = reinterpret_cast<char*>(c->send.buf) + ofs;
+      mg_mark(c);
+    }
+    for (size_t i = 0; i < count; i++)
+      out = MqttInflight::EncodeTo(out, msgs[i].topic, msgs[i].body, qos,
+                                   mqtt5, msgs[i].retain);
+    taken = count;
+  }
+  holding_ += taken;
   if (!c)
-    return false;
-  struct mg_mqtt_opts pub_opts = {
-      .topic = mg_str(msg.topic.data()),
-      .message = mg_str(msg.body.data()),
-      .qos = options_.qos,
-  };
-  mg_mqtt_pub(c, &pub_opts);
-  return true;
+    return taken;  // written once the next session is accepted
+  if (!linger || (options_.linger.max_messages &&
+                  holding_ >= options_.linger.max_messages)) {
+    Flush();
+  } else if (linger_timer_ == nullptr && holding_ > 0) {
+    uint64_t ms = (options_.linger.max_us + 999) / 1000;
+    linger_timer_ =
+        mg_timer_add(mgr_, ms, MG_TIMER_ONCE, &MqttConnect::Linger, this);
+  }
+  return taken;
 }
 
-bool MqttConnect::Subscribe(std::string_view topic) {
+void MqttConnect::Flush() {
   auto* c = static_cast<struct mg_connection*>(mgc_);
+  StopLinger();
   if (!c)
+    return;  // kept for the next session
+  holding_ = 0;
+  if (!held_.empty()) {
+    mg_send(c, held_.data(), held_.size());
+    held_.clear();
+  }
+  if (open_)
+    inflight_->Pump(c);
+}
+
+void MqttConnect::Linger(void* arg) {
+  auto* self = static_cast<MqttConnect*>(arg);
+  self->linger_timer_ = nullptr;  // one-shot, mongoose frees it
+  self->Flush();
+}
+
+void MqttConnect::StopLinger() {
+  if (linger_timer_) {
+    mg_timer_free(&mgr_->timers, linger_timer_);
+    mg_free(linger_timer_);
+    linger_timer_ = nullptr;
+  }
+}
+
+size_t MqttConnect::Inflight() const {
+  return inflight_->inflight();
+}
+
+size_t MqttConnect::Queued() const {
+  return inflight_->queued();
+}
+
+bool MqttConnect::PublishAsync(MqttMessage msg) {
+  return Post({.conn = shared_from_this(),
+               .topic = std::string(msg.topic),
+               .data = std::string(msg.body),
+               .retain = msg.retain});
+}
+
+void MqttConnect::Write(const Outbound& out) {
+  Publish({.topic = out.topic, .body = out.data, .retain = out.retain});
+}
+
+bool MqttConnect::Subscribe(std::string_view topic) {
+  if (!Routes::Valid(topic))
     return false;
-  struct mg_mqtt_opts opt = {
-      .user = mg_str(options_.user.c_str()),
-      .pass = mg_str(options_.pass.c_str()),
-      .qos = options_.qos,
-  };
-  opt.topic = mg_str(topic.data());
-  mg_mqtt_sub(c, &opt);
+  if (Track(topic) && session_)
+    SendSubscribe(&filters_.back(), 1);
+  return true;
+}
+
+bool MqttConnect::Subscribe(std::string_view filter,
+                            OnMqttMessage<IConnect> handler) {
+  if (!handler || !Routes::Valid(filter))
+    return false;
+  if (dispatching_) {
+    deferred_.emplace_back(std::string(filter), std::move(handler));
+    return true;
+  }
+  routes_->Remove(filter);
+  routes_->Insert(filter, std::move(handler));
+  if (Track(filter) && session_)
+    SendSubscribe(&filters_.back(), 1);
+  return true;
+}
+
+bool MqttConnect::Unsubscribe(std::string_view filter) {
+  if (dispatching_) {
+    deferred_.emplace_back(std::string(filter), nullptr);
+    return true;
+  }
+  routes_->Remove(filter);
+  auto it = std::find(filters_.begin(), filters_.end(), filter);
+  if (it == filters_.end())
+    return false;
+  filters_.erase(it);
+  if (session_)
+    SendUnsubscribe(filter);
+  return true;
+}
+
+void MqttConnect::Dispatch(const MqttMessage& msg) {
+  bool routed = false;
+  dispatching_ = true;
+  routes_->Match(msg.topic, [&](const OnMqttMessage<IConnect>& handler) {
+    routed = true;
+    handler(this, msg);
+  });
+  dispatching_ = false;
+  if (!routed && options_.on_message)
+    options_.on_message(this, msg);
+  auto deferred = std::move(deferred_);
+  deferred_.clear();
+  for (auto& [filter, handler] : deferred) {
+    if (handler)
+      Subscribe(filter, std::move(handler));
+    else
+      Unsubscribe(filter);
+  }
+}
+
+bool MqttConnect::Track(std::string_view filter) {
+  if (std::find(filters_.begin(), filters_.end(), filter) != filters_.end())
+    return false;
+  filters_.emplace_back(filter);
   return true;
 }
 
+void MqttConnect::SendSubscribe(const std::string* filters, size_t count) {
+  auto* c = static_cast<struct mg_connection*>(mgc_);
+  if (++c->mgr->mqtt_id == 0)
+    ++c->mgr->mqtt_id;
+  uint16_t id = c->mgr->mqtt_id;
+  size_t len = 2 + (c->is_mqtt5 ? 1 : 0);
+  for (size_t i = 0; i < count; i++)
+    len += 2 + filters[i].size() + 1;
+  char head[5];
+  size_t n = MqttInflight::EncodeHeader(head, MQTT_CMD_SUBSCRIBE << 4 | 2, len);
+  size_t ofs = c->send.len;
+  if (mg_iobuf_add(&c->send, ofs, nullptr, n + len) != n + len)
+    return;
+  mg_mark(c);
+  auto* out = c->send.buf + ofs;
+  memcpy(out, head, n);
+  out += n;
+  *out++ = static_cast<uint8_t>(id >> 8);
+  *out++ = static_cast<uint8_t>(id & 0xff);
+  if (c->is_mqtt5)
+    *out++ = 0;  // no properties
+  for (size_t i = 0; i < count; i++) {
+    const std::string& f = filters[i];
+    *out++ = static_cast<uint8_t>(f.size() >> 8);
+    *out++ = static_cast<uint8_t>(f.size() & 0xff);
+    memcpy(out, f.data(), f.size());
+    out += f.size();
+    *out++ = options_.qos;  // subscription options, qos in the low bits
+  }
+}
+
+void MqttConnect::SendUnsubscribe(std::string_view filter) {
+  auto* c = static_cast<struct mg_connection*>(mgc_);
+  if (++c->mgr->mqtt_id == 0)
+    ++c->mgr->mqtt_id;
+  uint16_t id = c->mgr->mqtt_id;
+  size_t len = 2 + (c->is_mqtt5 ? 1 : 0) + 2 + filter.size();
+  mg_mqtt_send_header(c, MQTT_CMD_UNSUBSCRIBE, 2, static_cast<uint32_t>(len));
+  uint8_t head[5] = {static_cast<uint8_t>(id >> 8),
+                     static_cast<uint8_t>(id & 0xff)};
+  size_t n = 2;
+  if (c->is_mqtt5)
+    head[n++] = 0;  // no properties
+  head[n++] = static_cast<uint8_t>(filter.size() >> 8);
+  head[n++] = static_cast<uint8_t>(filter.size() & 0xff);
+  mg_send(c, head, n);
+  mg_send(c, filter.data(), filter.size());
+}
+
 }  // namespace mg
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/08
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "connect.h"
+#include "connpool.h"
+
+namespace mg {
+
+HttpConnPool::~HttpConnPool() = default;
+
+std::string HttpConnPool::Key(std::string_view url) {
+  std::string u(url);
+  struct mg_str host = mg_url_host(u.c_str());
+  std::string key(mg_url_is_ssl(u.c_str()) ? "https://" : "http://");
+  key.append(host.buf, host.len);
+  key += ":" + std::to_string(mg_url_port(u.c_str()));
+  return key;
+}
+
+struct mg_connection* HttpConnPool::Acquire(const std::string& key) {
+  auto it = hosts_.find(key);
+  if (shutdown_ || it == hosts_.end() || it->second.idle.empty())
+    return nullptr;
+  /// most recently used first, it is the least likely to be stale
+  auto* c = it->second.idle.back();
+  it->second.idle.pop_back();
+  idle_.erase(c);
+  return c;
+}
+
+bool HttpConnPool::Open(const std::string& key) {
+  auto& host = hosts_[key];
+  if (shutdown_ || host.open >= options_.max_per_host)
+    return false;
+  host.open++;
+  return true;
+}
+
+void HttpConnPool::Wait(const std::string& key, Waiter req) {
+  hosts_[key].waiters.emplace_back(std::move(req));
+}
+
+void HttpConnPool::Release(const std::string& key, struct mg_connection* c) {
+  auto& host = hosts_[key];
+  if (!shutdown_ && !host.waiters.empty()) {
+    auto req = std::move(host.waiters.front());
+    host.waiters.pop_front();
+    req->Adopt(c);
+    return;
+  }
+  bool park = !shutdown_ && host.idle.size() < options_.max_idle;
+  c->fn = &HttpConnPool::IdleCallback;
+  c->fn_data = this;
+  idle_[c] = {.key = key, .since = mg_millis(), .parked = park};
+  if (park) {
+    host.idle.push_back(c);
+  } else {
+    c->is_draining = 1;
+    mg_mark(c);
+  }
+}
+
+void HttpConnPool::Closed(const std::string& key) {
+  auto& host = hosts_[key];
+  if (host.open > 0)
+    host.open--;
+  if (!shutdown_ && !host.waiters.empty()) {
+    auto req = std::move(host.waiters.front());
+    host.waiters.pop_front();
+    req->Init(req->mgr_);  // a slot is free, open or reuse one
+  }
+}
+
+void HttpConnPool::Shutdown() {
+  if (shutdown_)
+    return;
+  shutdown_ = true;
+  for (auto& [key, host] : hosts_) {
+    for (auto& req : host.waiters)
+      req->Abort("client stopped");
+    host.waiters.clear();
+    for (auto* c : host.idle) {
+      c->is_draining = 1;
+      mg_mark(c);
+    }
+  }
+}
+
+void HttpConnPool::IdleCallback(struct mg_connection* c, int ev,
+                                void* ev_data) {
+  auto* pool = static_cast<HttpConnPool*>(c->fn_data);
+  auto it = pool->idle_.find(c);
+  if (it == pool->idle_.end())
+    return;
+  if (ev == MG_EV_POLL && it->second.parked &&
+      mg_millis() - it->second.since > pool->options_.idle_timeout) {
+    c->is_draining = 1;
+  } else if (ev == MG_EV_CLOSE) {
+    auto& host = pool->hosts_[it->second.key];
+    auto pos = std::find(host.idle.begin(), host.idle.end(), c);
+    if (pos != host.idle.end())
+      host.idle.erase(pos);
+    std::string key = std::move(it->second.key);
+    pool->idle_.erase(it);
+    pool->Closed(key);
+  }
+  (void)ev_data;
+}
+
+}  // namespace mg
@@ -0,0 +1,80 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/08
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "common.h"
+#include "options.h"
+
+namespace mg {
+
+class HttpConnect;
+
+/// HTTP/1.1 keep-alive connections of one IClient, keyed by scheme+host+port.
+/// Lives on the loop thread, no locking.
+class HttpConnPool {
+ public:
+  using Waiter = std::shared_ptr<HttpConnect>;
+
+  explicit HttpConnPool(HttpPoolOptions options) : options_(options) {}
+  ~HttpConnPool();
+
+  static std::string Key(std::string_view url);
+
+  /// Idle connection to reuse for key, nullptr when none
+  struct mg_connection* Acquire(const std::string& key);
+  /// Account a new connection for key, false once max_per_host is reached
+  bool Open(const std::string& key);
+  /// Park a request until a connection for key frees up
+  void Wait(const std::string& key, Waiter req);
+  /// Response complete, c may serve the next request
+  void Release(const std::string& key, struct mg_connection* c);
+  /// A connection for key, owned by a request, has closed
+  void Closed(const std::string& key);
+  /// Fail parked requests and stop keeping connections
+  void Shutdown();
+
+ private:
+  static void IdleCallback(struct mg_connection* c, int ev, void* ev_data);
+
+ private:
+  struct Host {
+    size_t open = 0;
+    std::deque<struct mg_connection*> idle;
+    std::deque<Waiter> waiters;
+  };
+  struct Idle {
+    std::string key;
+    uint64_t since;  // idle since, milliseconds
+    bool parked;     // in Host::idle, otherwise draining
+  };
+
+  HttpPoolOptions options_;
+  std::unordered_map<std::string, Host> hosts_;
+  std::unordered_map<struct mg_connection*, Idle> idle_;
+  bool shutdown_ = false;
+};
+
+}  // namespace mg
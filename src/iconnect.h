@@ -21,35 +21,77 @@
 #pragma once
 
 #include <memory>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include "common.h"
+#include "tls.h"
 
 namespace mg {
 
+class IClient;
+class IConnect;
+
+/// Write queued from any thread, carried out on the owning loop thread
+struct Outbound {
+  std::shared_ptr<IConnect> conn;
+  std::string topic;  // MQTT publish only
+  std::string data;
+  bool retain = false;  // MQTT publish only
+  bool kill = false;    // end the connection, nothing to write
+};
+
+/// Posting side of an IClient, shared with its connections so that one
+/// kept after the IClient is gone fails to post instead of touching it
+struct LoopHandle {
+  std::shared_mutex mtx;    // shared by posters, exclusive to detach
+  IClient* loop = nullptr;  // null once the IClient is going away
+};
+
 class IConnect : virtual public std::enable_shared_from_this<IConnect> {
   friend class IClient;
 
  public:
   using Ptr = std::shared_ptr<IConnect>;
   virtual bool Send(std::string_view body);
-  bool kill();
+  /// Thread-safe Send, queued to the loop owning this connection, false
+  /// once that loop is gone
+  bool SendAsync(std::string body);
+  virtual std::string_view Url() const = 0;
+  /// End the connection from any thread, carried out by the loop owning
+  /// it; false once that loop is gone
+  virtual bool kill();
 
  private:
   virtual void Init(struct mg_mgr* mgr) = 0;
   virtual void Handler(int ev, void* ev_data) = 0;
   virtual void OnTimeout() = 0;
+  /// Carry out a queued write on the loop thread
+  virtual void Write(const Outbound& out);
+  /// Between connections but taking writes for the next one
+  virtual bool Reconnecting() const { return false; }
+  /// Grow the send buffer once ahead of a batch of writes
+  void Reserve(size_t size);
 
  protected:
   static void Timeout(void* fn_data);
   static void Callback(struct mg_connection* c, int ev, void* ev_data);
   void StartTimer(uint64_t period_ms, unsigned flags);
+  void StopTimer();
+  bool Post(Outbound out);
+  /// kill() on the loop thread, false when there is nothing to end
+  virtual bool End();
 
  protected:
   struct mg_mgr* mgr_ = nullptr;
   struct mg_connection* mgc_ = nullptr;
   std::string cause_ = "normal";
   std::function<void(Ptr)> on_release;
+  IClient* client_ = nullptr;  // loop owning this connection, loop thread only
+  std::shared_ptr<LoopHandle> handle_;  // of client_, for other threads
+
+ private:
+  struct mg_timer* timer_ = nullptr;  // pending one-shot timer
 };
 
 template <class OPTIONS>
@@ -57,10 +99,12 @@ class TcpConnect : public IConnect {
  public:
   TcpConnect(OPTIONS options) : options_(std::move(options)) {}
 
+  std::string_view Url() const override { return options_.url; }
+
  private:
   virtual void OnTimeout() {
     cause_ = "connection timeout";
-    kill();
+    End();
   }
 
   void Init(struct mg_mgr* mgr) override {
@@ -71,6 +115,11 @@ class TcpConnect : public IConnect {
 
  protected:
   void InitTls() {
+    if (options_.tls) {
+      struct mg_str host = mg_url_host(options_.url.c_str());
+      options_.tls->Init(mgc_, std::string_view(host.buf, host.len));
+      return;
+    }
     struct mg_tls_opts opts = {.ca = mg_unpacked(options_.ca.c_str()),
                                .cert = mg_unpacked(options_.cert.c_str()),
                                .key = mg_unpacked(options_.key.c_str()),
@@ -78,6 +127,19 @@ class TcpConnect : public IConnect {
     mg_tls_init(mgc_, &opts);
   }
 
+  /// Report the close and hand the object back to its loop, this may be
+  /// destroyed on return unless the caller holds a reference
+  void Finish() {
+    StopTimer();
+    if (options_.on_close) {
+      options_.on_close(this, cause_);
+    }
+    mgc_ = nullptr;  // freed by mongoose or owned by someone else now
+    if (this->on_release) {
+      this->on_release(this->shared_from_this());
+    }
+  }
+
   void Handler(int ev, void* ev_data) override {
     switch (ev) {
       case MG_EV_ERROR:
@@ -85,16 +147,15 @@ class TcpConnect : public IConnect {
         break;
       case MG_EV_OPEN:
         if (options_.timeout) {
-          StartTimer(options_.timeout, MG_TIMER_RUN_NOW);
+          StartTimer(options_.timeout, MG_TIMER_ONCE);
         }
         break;
+      case MG_EV_POLL:
+      case MG_EV_WRITE:
+        CheckWatermarks<IConnect>(this, mgc_, options_);
+        break;
       case MG_EV_CLOSE:
-        if (options_.on_close) {
-          options_.on_close(this, cause_);
-        }
-        if (this->on_release) {
-          this->on_release(this->shared_from_this());
-        }
+        Finish();
         break;
       case MG_EV_READ:
         if (options_.on_read) {
@@ -107,6 +168,7 @@ class TcpConnect : public IConnect {
         }
         break;
       case MG_EV_CONNECT: {
+        ApplyBuffers(mgc_, options_.buffers);  // mgc_ is unset at MG_EV_OPEN
         if (mg_url_is_ssl(options_.url.c_str())) {
           InitTls();
         } else {
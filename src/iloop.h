@@ -20,23 +20,49 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <mutex>
 #include <thread>
 #include "common.h"
+#include "slab.h"
 
 namespace mg {
 
 class ILoop {
+  /// upper bound of a Poll so that mongoose internals (DNS timeouts) tick
+  static constexpr uint64_t kMaxPollMs = 1000;
+
  public:
-  ILoop()
-      : exit_(false),
-        thread_(std::make_unique<std::thread>(&ILoop::StartRoutine, this)) {}
+  ILoop() : exit_(false) {}
 
   virtual ~ILoop() = default;
 
+  /// Counters of the slab pools, zeros unless enabled
+  SlabStats MemoryStats() const { return slab_ ? slab_->Stats() : SlabStats(); }
+
  protected:
-  void Stop() {
+  /// Pool connections and buffers of this loop, call before Start()
+  void EnableSlab(const SlabOptions& options) {
+    if (options.enable)
+      slab_ = std::make_unique<SlabAllocator>(options);
+  }
+
+  /// Spawn the loop thread, called once the virtual InitLoop/EventLoop are
+  /// complete, i.e. by the most derived constructor
+  void Start() {
+    if (!thread_) {
+      thread_ = std::make_unique<std::thread>(&ILoop::StartRoutine, this);
+    }
+  }
+
+  void Quit() {
     exit_ = true;
+    Wakeup();
+  }
+
+  void Stop() {
+    Quit();
     if (thread_ && thread_->joinable()) {
       thread_->join();
       thread_ = nullptr;
@@ -48,13 +74,63 @@ class ILoop {
   void Flush() {
     for (auto* c = mgr_.conns; c != NULL; c = c->next) {
       c->is_draining = 1;
+      mg_mark(c);
     }
   }
 
+  /// Interrupt a blocking Poll from any thread, wakeups coalesce until the
+  /// loop has been through the next Poll
+  void Wakeup() {
+    if (woken_.exchange(true, std::memory_order_acq_rel))
+      return;
+    std::lock_guard<std::mutex> guard(wake_mtx_);
+    if (wake_id_) {
+      mg_wakeup(&mgr_, wake_id_, "", 0);
+    }
+  }
+
+  /// Milliseconds Poll may block before the earliest timer is due
+  int NextTimeout() {
+    uint64_t now = mg_millis(), ms = kMaxPollMs;
+    for (auto* t = mgr_.timers; t != NULL && ms > 0; t = t->next) {
+      if (!(t->flags & MG_TIMER_REPEAT) && (t->flags & MG_TIMER_CALLED))
+        continue;  // one-shot timer already fired
+      if (t->expire == 0) {
+        ms = (t->flags & MG_TIMER_RUN_NOW) ? 0 : std::min(ms, t->period_ms);
+      } else {
+        ms = t->expire > now ? std::min(ms, t->expire - now) : 0;
+      }
+    }
+    return static_cast<int>(ms);
+  }
+
+  /// Run one poll pass; false once stopped and every connection is drained
+  bool Poll() {
+    mg_mgr_poll(&mgr_, NextTimeout());
+    woken_.exchange(false, std::memory_order_acq_rel);
+    if (Stopped()) {
+      if (mgr_.conns == NULL)
+        return false;  // exit loop
+      if (wake_id_) {
+        /// wakeup pipe is drained with the rest
+        std::lock_guard<std::mutex> guard(wake_mtx_);
+        wake_id_ = 0;
+      }
+      Flush();
+    }
+    return true;
+  }
+
  protected:
   virtual void InitLoop() {
     mg_log_set(MG_LL_INFO);
     mg_mgr_init(&mgr_);
+    if (slab_)
+      mgr_.allocator = slab_->get();
+    if (mg_wakeup_init(&mgr_)) {
+      std::lock_guard<std::mutex> guard(wake_mtx_);
+      wake_id_ = mgr_.conns->id;
+    }
   }
 
   virtual void UninitLoop() { mg_mgr_free(&mgr_); }
@@ -73,7 +149,11 @@ class ILoop {
 
  private:
   std::atomic<bool> exit_;
+  std::atomic<bool> woken_ = false;
+  std::mutex wake_mtx_;
+  unsigned long wake_id_ = 0;  // id of the mg_wakeup pipe connection
   std::unique_ptr<std::thread> thread_;
+  std::unique_ptr<SlabAllocator> slab_;  // outlives mg_mgr_free
 };
 
 }  // namespace mg
\ No newline at end of file
@@ -22,13 +22,21 @@
 
 #include <string_view>
 #include "iloop.h"
+#include "tls.h"
 
 namespace mg {
 
 template <class OPTIONS>
 class IServer : public ILoop {
  public:
-  IServer(OPTIONS options) : options_(std::move(options)) {};
+  /// The loop starts here unless manual_start is set. Subclasses that
+  /// override InitLoop/EventLoop set it and call Start() at the end of their
+  /// constructor, so the loop thread never sees a half-built object.
+  IServer(OPTIONS options, bool manual_start = false)
+      : options_(std::move(options)) {
+    if (!manual_start)
+      Start();
+  }
   virtual ~IServer() { Stop(); }
 
  protected:
@@ -38,6 +46,11 @@ class IServer : public ILoop {
   }
 
   void InitTls(struct mg_connection* c) {
+    if (options_.tls) {
+      struct mg_str host = mg_url_host(options_.url.c_str());
+      options_.tls->Init(c, std::string_view(host.buf, host.len));
+      return;
+    }
     struct mg_tls_opts opts = {.ca = mg_unpacked(options_.ca.c_str()),
                                .cert = mg_unpacked(options_.cert.c_str()),
                                .key = mg_unpacked(options_.key.c_str()),
@@ -47,6 +60,13 @@ class IServer : public ILoop {
 
   virtual void Handler(struct mg_connection* c, int ev, void* ev_data) {
     switch (ev) {
+      case MG_EV_OPEN:
+        ApplyBuffers(c, options_.buffers);
+        break;
+      case MG_EV_POLL:
+      case MG_EV_WRITE:
+        CheckWatermarks<IServer>(c, c, options_);
+        break;
       case MG_EV_CLOSE:
         if (options_.on_close) {
           options_.on_close(this, "");
@@ -57,8 +77,10 @@ class IServer : public ILoop {
           options_.on_read(
               this, std::string_view(reinterpret_cast<const char*>(c->recv.buf),
                                      c->recv.len));
-          /// Tell Mongoose we've consumed data
-          mg_iobuf_del(&c->recv, 0, c->recv.len);
+          /// Tell Mongoose we've consumed data, unless a protocol handler
+          /// (http_cb, mqtt_cb) keeps a partial message there
+          if (c->pfn == NULL)
+            mg_iobuf_del(&c->recv, 0, c->recv.len);
         }
         break;
       case MG_EV_ACCEPT:
@@ -86,15 +108,7 @@ class IServer : public ILoop {
     mg_listen(&mgr_, options_.url.data(), &IServer::Callback, this);
   }
 
-  virtual bool EventLoop() override {
-    mg_mgr_poll(&mgr_, 50);
-    if (Stopped()) {
-      if (mgr_.conns == NULL)
-        return false;  // exit loop
-      Flush();
-    }
-    return true;
-  }
+  virtual bool EventLoop() override { return Poll(); }
 
  protected:
   OPTIONS options_;
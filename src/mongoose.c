@@ -19,6 +19,13 @@
 
 #include "mongoose.h"
 
+#if MG_ENABLE_IO_URING
+#include "uring.h"
+#endif
+#if MG_ENABLE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #ifdef MG_ENABLE_LINES
 #line 1 "src/base64.c"
 #endif
@@ -507,6 +514,7 @@ void mg_error(struct mg_connection *c, const char *fmt, ...) {
   va_end(ap);
   MG_ERROR(("%lu %ld %s", c->id, c->fd, buf));
   c->is_closing = 1;             // Set is_closing before sending MG_EV_CALL
+  mg_mark(c);
   mg_call(c, MG_EV_ERROR, buf);  // Let user handler override it
 }
 
@@ -1818,7 +1826,7 @@ void mg_http_write_chunk(struct mg_connection *c, const char *buf, size_t len) {
 }
 
 // clang-format off
-static const char *mg_http_status_code_str(int status_code) {
+const char *mg_http_status_code_str(int status_code) {
   switch (status_code) {
     case 100: return "Continue";
     case 101: return "Switching Protocols";
@@ -1914,7 +1922,6 @@ static void restore_http_cb(struct mg_connection *c) {
   c->is_resp = 0;
 }
 
-char *mg_http_etag(char *buf, size_t len, size_t size, time_t mtime);
 char *mg_http_etag(char *buf, size_t len, size_t size, time_t mtime) {
   mg_snprintf(buf, len, "\"%lld.%lld\"", (int64_t) mtime, (int64_t) size);
   return buf;
@@ -1940,6 +1947,17 @@ static void static_cb(struct mg_connection *c, int ev, void *ev_data) {
   (void) ev_data;
 }
 
+#if MG_ENABLE_SENDFILE
+// File body queued with mg_sendfile(), hand the connection back once sent
+static void sendfile_cb(struct mg_connection *c, int ev, void *ev_data) {
+  if ((ev == MG_EV_WRITE && c->sendfile_len == 0) || ev == MG_EV_CLOSE) {
+    c->sendfile_len = 0;
+    restore_http_cb(c);
+  }
+  (void) ev_data;
+}
+#endif
+
 // Known mime types. Keep it outside guess_content_type() function, since
 // some environments don't like it defined there.
 // clang-format off
@@ -2004,6 +2022,10 @@ static struct mg_str guess_content_type(struct mg_str path, const char *extra) {
   return mg_str("text/plain; charset=utf-8");
 }
 
+struct mg_str mg_http_content_type(struct mg_str path, const char *mime_types) {
+  return guess_content_type(path, mime_types);
+}
+
 static int getrange(struct mg_str *s, size_t *a, size_t *b) {
   size_t i, numparsed = 0;
   for (i = 0; i + 6 < s->len; i++) {
@@ -2099,6 +2121,12 @@ void mg_http_serve_file(struct mg_connection *c, struct mg_http_message *hm,
     if (mg_strcasecmp(hm->method, mg_str("HEAD")) == 0) {
       c->is_resp = 0;
       mg_fs_close(fd);
+#if MG_ENABLE_SENDFILE
+    } else if (opts->sendfile && fs == &mg_fs_posix && cl > 0 &&
+               mg_sendfile(c, fileno((FILE *) fd->fd), r1, cl)) {
+      c->pfn = sendfile_cb;  // Zero-copy, the kernel sends the range
+      c->pfn_data = fd;
+#endif
     } else {
       // Track to-be-sent content length at the end of c->data, aligned
       size_t *clp = (size_t *) &c->data[(sizeof(c->data) - sizeof(size_t)) /
@@ -2590,22 +2618,42 @@ static size_t roundup(size_t size, size_t align) {
   return align == 0 ? size : (size + align - 1) / align * align;
 }
 
+// Size to grow io to so that it holds need bytes, per io->growth
+static size_t iobuf_grow_size(struct mg_iobuf *io, size_t need) {
+  size_t size = io->size;
+  if (io->growth > 1 && size > 0) {
+    while (size < need) size *= io->growth;
+    return size;
+  }
+  return need;
+}
+
+static void iobuf_free(struct mg_iobuf *io) {
+  if (io->buf == NULL) return;
+  if (io->alloc != NULL) {
+    io->alloc->buf_free(io->alloc->ctx, io->buf, io->size);
+  } else {
+    mg_free(io->buf);
+  }
+}
+
 int mg_iobuf_resize(struct mg_iobuf *io, size_t new_size) {
   int ok = 1;
   new_size = roundup(new_size, io->align);
   if (new_size == 0) {
     mg_bzero(io->buf, io->size);
-    mg_free(io->buf);
+    iobuf_free(io);
     io->buf = NULL;
     io->len = io->size = 0;
   } else if (new_size != io->size) {
     // NOTE(lsm): do not use realloc here. Use mg_calloc/mg_free only
-    void *p = mg_calloc(1, new_size);
+    void *p = io->alloc != NULL ? io->alloc->buf_alloc(io->alloc->ctx, new_size)
+                                : mg_calloc(1, new_size);
     if (p != NULL) {
       size_t len = new_size < io->len ? new_size : io->len;
       if (len > 0 && io->buf != NULL) memmove(p, io->buf, len);
       mg_bzero(io->buf, io->size);
-      mg_free(io->buf);
+      iobuf_free(io);
       io->buf = (unsigned char *) p;
       io->size = new_size;
       io->len = len;
@@ -2621,14 +2669,22 @@ int mg_iobuf_init(struct mg_iobuf *io, size_t size, size_t align) {
   io->buf = NULL;
   io->align = align;
   io->size = io->len = 0;
+  io->growth = 0;
+  io->alloc = NULL;
   return mg_iobuf_resize(io, size);
 }
 
 size_t mg_iobuf_add(struct mg_iobuf *io, size_t ofs, const void *buf,
                     size_t len) {
   size_t new_size = roundup(io->len + len, io->align);
-  mg_iobuf_resize(io, new_size);      // Attempt to resize
-  if (new_size != io->size) len = 0;  // Resize failure, append nothing
+  if (io->growth > 0) {  // Keep the capacity, grow when short
+    if (new_size > io->size)
+      mg_iobuf_resize(io, iobuf_grow_size(io, new_size));
+    if (new_size > io->size) len = 0;  // Resize failure, append nothing
+  } else {
+    mg_iobuf_resize(io, new_size);      // Attempt to resize
+    if (new_size != io->size) len = 0;  // Resize failure, append nothing
+  }
   if (ofs < io->len) memmove(io->buf + ofs + len, io->buf + ofs, io->len - ofs);
   if (buf != NULL) memmove(io->buf + ofs, buf, len);
   if (ofs > io->len) io->len += ofs - io->len;
@@ -3867,6 +3923,7 @@ struct mg_connection *mg_mqtt_listen(struct mg_mgr *mgr, const char *url,
 size_t mg_vprintf(struct mg_connection *c, const char *fmt, va_list *ap) {
   size_t old = c->send.len;
   mg_vxprintf(mg_pfn_iobuf, &c->send, fmt, ap);
+  mg_mark(c);
   return c->send.len - old;
 }
 
@@ -3982,10 +4039,14 @@ bool mg_aton(struct mg_str str, struct mg_addr *addr) {
 }
 
 struct mg_connection *mg_alloc_conn(struct mg_mgr *mgr) {
+  struct mg_allocator *a = mgr->allocator;
+  size_t size = sizeof(struct mg_connection) + mgr->extraconnsize;
   struct mg_connection *c =
-      (struct mg_connection *) mg_calloc(1, sizeof(*c) + mgr->extraconnsize);
+      (struct mg_connection *) (a != NULL ? a->conn_alloc(a->ctx, size)
+                                          : mg_calloc(1, size));
   if (c != NULL) {
     c->mgr = mgr;
+    c->alloc = c->send.alloc = c->recv.alloc = c->rtls.alloc = a;
     c->send.align = c->recv.align = c->rtls.align = MG_IO_SIZE;
     c->id = ++mgr->nextid;
     MG_PROF_INIT(c);
@@ -3993,9 +4054,49 @@ struct mg_connection *mg_alloc_conn(struct mg_mgr *mgr) {
   return c;
 }
 
+void mg_mark(struct mg_connection *c) {
+#if MG_ENABLE_EPOLL_READY
+  struct mg_mgr *mgr = c->mgr;
+  if (c->is_queued) return;
+  c->is_queued = 1;
+  c->ready_next = NULL;
+  c->ready_prev = mgr->ready_tail;
+  if (mgr->ready_tail != NULL) {
+    mgr->ready_tail->ready_next = c;
+  } else {
+    mgr->ready_head = c;
+  }
+  mgr->ready_tail = c;
+  mgr->ready_len++;
+#else
+  (void) c;  // Every connection is dispatched on every poll
+#endif
+}
+
+static void mg_unmark(struct mg_connection *c) {
+  struct mg_mgr *mgr = c->mgr;
+  if (!c->is_queued) return;
+  if (c->ready_prev != NULL) {
+    c->ready_prev->ready_next = c->ready_next;
+  } else {
+    mgr->ready_head = c->ready_next;
+  }
+  if (c->ready_next != NULL) {
+    c->ready_next->ready_prev = c->ready_prev;
+  } else {
+    mgr->ready_tail = c->ready_prev;
+  }
+  c->ready_next = c->ready_prev = NULL;
+  c->is_queued = 0;
+  mgr->ready_len--;
+}
+
 void mg_close_conn(struct mg_connection *c) {
+  struct mg_allocator *a = c->alloc;
+  size_t size = sizeof(*c) + c->mgr->extraconnsize;
   mg_resolve_cancel(c);  // Close any pending DNS query
   LIST_DELETE(struct mg_connection, &c->mgr->conns, c);
+  mg_unmark(c);
   if (c == c->mgr->dns4.c) c->mgr->dns4.c = NULL;
   if (c == c->mgr->dns6.c) c->mgr->dns6.c = NULL;
   // Order of operations is important. `MG_EV_CLOSE` event must be fired
@@ -4010,7 +4111,11 @@ void mg_close_conn(struct mg_connection *c) {
   mg_iobuf_free(&c->send);
   mg_iobuf_free(&c->rtls);
   mg_bzero((unsigned char *) c, sizeof(*c));
-  mg_free(c);
+  if (a != NULL) {
+    a->conn_free(a->ctx, c, size);
+  } else {
+    mg_free(c);
+  }
 }
 
 struct mg_connection *mg_connect_svc(struct mg_mgr *mgr, const char *url,
@@ -4103,7 +4208,7 @@ void mg_mgr_free(struct mg_mgr *mgr) {
   struct mg_timer *tmp, *t = mgr->timers;
   while (t != NULL) tmp = t->next, mg_free(t), t = tmp;
   mgr->timers = NULL;  // Important. Next call to poll won't touch timers
-  for (c = mgr->conns; c != NULL; c = c->next) c->is_closing = 1;
+  for (c = mgr->conns; c != NULL; c = c->next) c->is_closing = 1, mg_mark(c);
   mg_mgr_poll(mgr, 0);
 #if MG_ENABLE_FREERTOS_TCP
   FreeRTOS_DeleteSocketSet(mgr->ss);
@@ -4111,6 +4216,9 @@ void mg_mgr_free(struct mg_mgr *mgr) {
   MG_DEBUG(("All connections closed"));
 #if MG_ENABLE_EPOLL
   if (mgr->epoll_fd >= 0) close(mgr->epoll_fd), mgr->epoll_fd = -1;
+#endif
+#if MG_ENABLE_IO_URING
+  mg_uring_free((struct mg_uring *) mgr->uring), mgr->uring = NULL;
 #endif
   mg_tls_ctx_free(mgr);
 #if MG_ENABLE_TCPIP
@@ -4140,6 +4248,10 @@ void mg_mgr_init(struct mg_mgr *mgr) {
   MG_TCPIP_DRIVER_INIT(mgr);
 #endif
   mgr->pipe = MG_INVALID_SOCKET;
+#if MG_ENABLE_IO_URING
+  if ((mgr->uring = mg_uring_new(MG_IO_URING_ENTRIES)) == NULL)
+    MG_ERROR(("io_uring_setup errno %d, using plain sockets", errno));
+#endif
   mgr->dnstimeout = 3000;
   mgr->dns4.url = "udp://8.8.8.8:53";
   mgr->dns6.url = "udp://[2001:4860:4860::8888]:53";
@@ -4711,7 +4823,7 @@ static bool rx_udp(struct mg_tcpip_if *ifp, struct pkt *pkt) {
   c->rem.port = pkt->udp->sport;
   memcpy(c->rem.ip, &pkt->ip->src, sizeof(uint32_t));
   memcpy(s->mac, pkt->eth->src, sizeof(s->mac));
-  if (c->recv.len >= MG_MAX_RECV_SIZE) {
+  if (c->recv.len >= MG_RECV_LIMIT(c)) {
     mg_error(c, "max_recv_buf_size reached");
   } else if (c->recv.size - c->recv.len < pkt->pay.len &&
              !mg_iobuf_resize(&c->recv, c->recv.len + pkt->pay.len)) {
@@ -4861,9 +4973,15 @@ long mg_io_send(struct mg_connection *c, const void *buf, size_t len) {
   return (long) len;
 }
 
+bool mg_sendfile(struct mg_connection *c, int fd, uint64_t offset,
+                 size_t len) {
+  (void) c, (void) fd, (void) offset, (void) len;
+  return false;
+}
+
 static void handle_tls_recv(struct mg_connection *c) {
   size_t avail = mg_tls_pending(c);
-  size_t min = avail > MG_MAX_RECV_SIZE ? MG_MAX_RECV_SIZE : avail;
+  size_t min = avail > MG_RECV_LIMIT(c) ? MG_RECV_LIMIT(c) : avail;
   struct mg_iobuf *io = &c->recv;
   if (io->size - io->len < min && !mg_iobuf_resize(io, io->len + min)) {
     mg_error(c, "oom");
@@ -7829,7 +7947,8 @@ size_t mg_queue_printf(struct mg_queue *q, const char *fmt, ...) {
 
 static void mg_pfn_iobuf_private(char ch, void *param, bool expand) {
   struct mg_iobuf *io = (struct mg_iobuf *) param;
-  if (expand && io->len + 2 > io->size) mg_iobuf_resize(io, io->len + 2);
+  if (expand && io->len + 2 > io->size)
+    mg_iobuf_resize(io, iobuf_grow_size(io, io->len + 2));
   if (io->len + 2 <= io->size) {
     io->buf[io->len++] = (uint8_t) ch;
     io->buf[io->len] = 0;
@@ -8848,6 +8967,10 @@ struct mg_connection *mg_sntp_connect(struct mg_mgr *mgr, const char *url,
 #define FD(c_) ((MG_SOCKET_TYPE) (size_t) (c_)->fd)
 #define S2PTR(s_) ((void *) (size_t) (s_))
 
+#if !defined(MSG_NONBLOCKING) && MG_ENABLE_EPOLL_READY
+#define MSG_NONBLOCKING MSG_DONTWAIT  // Edges drain until EAGAIN, mg_wrapfd too
+#endif
+
 #ifndef MSG_NONBLOCKING
 #define MSG_NONBLOCKING 0
 #endif
@@ -8938,7 +9061,7 @@ static void iolog(struct mg_connection *c, char *buf, long n, bool r) {
     } else {
       mg_iobuf_del(&c->send, 0, (size_t) n);
       // if (c->send.len == 0) mg_iobuf_resize(&c->send, 0);
-      if (c->send.len == 0) {
+      if (c->send.len == 0 && c->sendfile_len == 0) {
         MG_EPOLL_MOD(c, 0);
       }
       mg_call(c, MG_EV_WRITE, &n);
@@ -8957,12 +9080,26 @@ long mg_io_send(struct mg_connection *c, const void *buf, size_t len) {
     n = send(FD(c), (char *) buf, len, MSG_NONBLOCKING);
   }
   MG_VERBOSE(("%lu %ld %d", c->id, n, MG_SOCK_ERR(n)));
-  if (MG_SOCK_PENDING(n)) return MG_IO_WAIT;
+  if (MG_SOCK_PENDING(n)) return c->is_wready = 0, MG_IO_WAIT;
   if (MG_SOCK_RESET(n)) return MG_IO_RESET;  // MbedTLS, see #1507
   if (n <= 0) return MG_IO_ERR;
   return n;
 }
 
+bool mg_sendfile(struct mg_connection *c, int fd, uint64_t offset,
+                 size_t len) {
+#if MG_ENABLE_SENDFILE
+  if (c->is_udp || c->is_tls || c->is_listening || c->sendfile_len > 0)
+    return false;
+  c->sendfile_fd = fd, c->sendfile_off = offset, c->sendfile_len = len;
+  mg_mark(c);
+  return true;
+#else
+  (void) c, (void) fd, (void) offset, (void) len;
+  return false;
+#endif
+}
+
 bool mg_send(struct mg_connection *c, const void *buf, size_t len) {
   if (c->is_udp) {
     long n = mg_io_send(c, buf, len);
@@ -8971,6 +9108,7 @@ bool mg_send(struct mg_connection *c, const void *buf, size_t len) {
     iolog(c, (char *) buf, n, false);
     return n > 0;
   } else {
+    mg_mark(c);
     return mg_iobuf_add(&c->send, c->send.len, buf, len);
   }
 }
@@ -9066,6 +9204,13 @@ bool mg_open_listener(struct mg_connection *c, const char *url) {
       // won't work! (setsockopt will return EINVAL)
       MG_ERROR(("setsockopt(SO_REUSEADDR): %d", MG_SOCK_ERR(rc)));
 #endif
+#if defined(SO_REUSEPORT) && !defined(LWIP_SOCKET)
+    } else if (c->mgr->reuseport &&
+               (rc = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *) &on,
+                                sizeof(on))) != 0) {
+      // Several listeners, one per thread, share the port; kernel balances
+      MG_ERROR(("setsockopt(SO_REUSEPORT): %d", MG_SOCK_ERR(rc)));
+#endif
 #if MG_IPV6_V6ONLY
       // Bind only to the V6 address, not V4 address on this port
     } else if (c->loc.is_ip6 &&
@@ -9098,13 +9243,13 @@ static long recv_raw(struct mg_connection *c, void *buf, size_t len) {
   if (c->is_udp) {
     union usa usa;
     socklen_t slen = tousa(&c->rem, &usa);
-    n = recvfrom(FD(c), (char *) buf, len, 0, &usa.sa, &slen);
+    n = recvfrom(FD(c), (char *) buf, len, MSG_NONBLOCKING, &usa.sa, &slen);
     if (n > 0) tomgaddr(&usa, &c->rem, slen != sizeof(usa.sin));
   } else {
     n = recv(FD(c), (char *) buf, len, MSG_NONBLOCKING);
   }
   MG_VERBOSE(("%lu %ld %d", c->id, n, MG_SOCK_ERR(n)));
-  if (MG_SOCK_PENDING(n)) return MG_IO_WAIT;
+  if (MG_SOCK_PENDING(n)) return c->is_rready = 0, MG_IO_WAIT;
   if (MG_SOCK_RESET(n)) return MG_IO_RESET;  // MbedTLS, see #1507
   if (n <= 0) return MG_IO_ERR;
   return n;
@@ -9112,10 +9257,10 @@ static long recv_raw(struct mg_connection *c, void *buf, size_t len) {
 
 static bool ioalloc(struct mg_connection *c, struct mg_iobuf *io) {
   bool res = false;
-  if (io->len >= MG_MAX_RECV_SIZE) {
+  if (io->len >= MG_RECV_LIMIT(c)) {
     mg_error(c, "MG_MAX_RECV_SIZE");
   } else if (io->size <= io->len &&
-             !mg_iobuf_resize(io, io->size + MG_IO_SIZE)) {
+             !mg_iobuf_resize(io, iobuf_grow_size(io, io->size + io->align))) {
     mg_error(c, "OOM");
   } else {
     res = true;
@@ -9164,16 +9309,145 @@ static void read_conn(struct mg_connection *c) {
   }
 }
 
+#if MG_ENABLE_SENDFILE
+// The kernel moves file pages to the socket, no copy through user space
+static void sendfile_conn(struct mg_connection *c) {
+  off_t off = (off_t) c->sendfile_off;
+  size_t len = c->sendfile_len < 0x7ffff000 ? c->sendfile_len : 0x7ffff000;
+  long n = (long) sendfile(FD(c), c->sendfile_fd, &off, len);
+  MG_DEBUG(("%lu %ld sendfile %lu left n=%ld err=%d", c->id, c->fd,
+            (unsigned long) c->sendfile_len, n, MG_SOCK_ERR(n)));
+  if (n > 0) {
+    c->sendfile_off += (uint64_t) n, c->sendfile_len -= (size_t) n;
+    if (c->sendfile_len == 0) MG_EPOLL_MOD(c, 0);
+    mg_call(c, MG_EV_WRITE, &n);
+  } else if (n == 0) {
+    mg_error(c, "sendfile: file truncated");
+  } else if (MG_SOCK_PENDING(n)) {
+    c->is_wready = 0;  // Socket buffer is full, wait for the next edge
+  } else {
+    c->is_closing = 1;  // Termination, same as iolog()
+  }
+}
+#endif
+
 static void write_conn(struct mg_connection *c) {
   char *buf = (char *) c->send.buf;
   size_t len = c->send.len;
-  long n = c->is_tls ? mg_tls_send(c, buf, len) : mg_io_send(c, buf, len);
+  long n;
+#if MG_ENABLE_SENDFILE
+  if (len == 0 && c->sendfile_len > 0) {
+    sendfile_conn(c);
+    return;
+  }
+#endif
+  n = c->is_tls ? mg_tls_send(c, buf, len) : mg_io_send(c, buf, len);
   MG_DEBUG(("%lu %ld snd %ld/%ld rcv %ld/%ld n=%ld err=%d", c->id, c->fd,
             (long) c->send.len, (long) c->send.size, (long) c->recv.len,
             (long) c->recv.size, n, MG_SOCK_ERR(n)));
   iolog(c, buf, n, false);
 }
 
+#if MG_ENABLE_IO_URING
+// Plain TCP sockets get their recv()/send() batched through io_uring: reads
+// of all ready sockets go in one io_uring_enter() before dispatch, and every
+// write produced by the handlers goes in one io_uring_enter() after it
+#define URING_TX 1U  // Low bit of the request tag, connections are aligned
+
+static bool uring_eligible(struct mg_connection *c) {
+  return c->mgr->uring != NULL && !c->is_tls && !c->is_udp &&
+         c->sendfile_len == 0 &&
+         !c->is_listening && !c->is_connecting && !c->is_resolving &&
+         !c->is_closing && FD(c) != MG_INVALID_SOCKET;
+}
+
+static long uring_res(long res) {
+  if (res == -EAGAIN || res == -EWOULDBLOCK || res == -EINTR) return MG_IO_WAIT;
+  if (res == -ECONNRESET) return MG_IO_RESET;
+  return res <= 0 ? MG_IO_ERR : res;
+}
+
+static void uring_reap(struct mg_mgr *mgr) {
+  struct mg_uring *u = (struct mg_uring *) mgr->uring;
+  uint64_t tag;
+  long res;
+  mg_uring_wait(u);
+  while (mg_uring_reap(u, &tag, &res)) {
+    struct mg_connection *c =
+        (struct mg_connection *) (uintptr_t) (tag & ~(uint64_t) URING_TX);
+    long n = uring_res(res);
+    if (tag & URING_TX) {
+      // Buffer is accounted right away, a write cannot race the handlers
+      MG_DEBUG(("%lu %ld snd %ld/%ld n=%ld", c->id, c->fd, (long) c->send.len,
+                (long) c->send.size, n));
+      iolog(c, (char *) c->send.buf, n, false);
+    } else {
+      // Commit received bytes now, MG_EV_POLL handlers run before MG_EV_READ
+      // and may shift c->recv
+      MG_DEBUG(("%lu %ld rcv %ld/%ld n=%ld", c->id, c->fd, (long) c->recv.len,
+                (long) c->recv.size, n));
+      if (n > 0) {
+        if (c->is_hexdumping) mg_hexdump(&c->recv.buf[c->recv.len], (size_t) n);
+        c->recv.len += (size_t) n;
+      }
+      c->uring_rx = n, c->is_uring_rx = 1;
+    }
+  }
+}
+
+static void uring_queue(struct mg_mgr *mgr, struct mg_connection *c, bool rx) {
+  struct mg_uring *u = (struct mg_uring *) mgr->uring;
+  uint64_t tag = (uint64_t) (uintptr_t) c | (rx ? 0 : URING_TX);
+  for (;;) {
+    bool ok = rx ? mg_uring_recv(u, (int) FD(c), &c->recv.buf[c->recv.len],
+                                 c->recv.size - c->recv.len, tag)
+                 : mg_uring_send(u, (int) FD(c), c->send.buf, c->send.len, tag);
+    if (ok) break;
+    uring_reap(mgr);  // Submission queue is full, flush it
+  }
+}
+
+// Before dispatch: read every ready socket, flush writable backlogs
+static void uring_read(struct mg_mgr *mgr) {
+  struct mg_connection *c;
+  bool queued = false;
+  for (c = mgr->conns; c != NULL; c = c->next) {
+    if (!uring_eligible(c)) continue;
+    if (c->is_readable && ioalloc(c, &c->recv)) {
+      uring_queue(mgr, c, true), queued = true;
+    }
+    if (c->is_writable && c->send.len > 0) {
+      uring_queue(mgr, c, false), queued = true;
+    }
+    c->is_readable = c->is_writable = 0;  // Taken over by io_uring
+  }
+  if (queued) uring_reap(mgr);
+}
+
+// After dispatch: send whatever handlers produced in this iteration. Sends
+// are MSG_DONTWAIT, a full socket just stays queued for EPOLLOUT
+static void uring_write(struct mg_mgr *mgr) {
+  struct mg_connection *c;
+  bool queued = false;
+  for (c = mgr->conns; c != NULL; c = c->next) {
+    if (uring_eligible(c) && c->send.len > 0) {
+      uring_queue(mgr, c, false), queued = true;
+    }
+  }
+  if (queued) uring_reap(mgr);
+}
+
+static void uring_conn(struct mg_connection *c) {
+  long n = c->uring_rx;
+  c->is_uring_rx = 0;
+  if (n > 0) {
+    mg_call(c, MG_EV_READ, &n);
+  } else if (n != MG_IO_WAIT) {
+    c->is_closing = 1;  // Termination, same as iolog()
+  }
+}
+#endif
+
 static void close_conn(struct mg_connection *c) {
   if (FD(c) != MG_INVALID_SOCKET) {
 #if MG_ENABLE_EPOLL
@@ -9275,7 +9549,9 @@ static void accept_conn(struct mg_mgr *mgr, struct mg_connection *lsn) {
   union usa usa;
   socklen_t sa_len = sizeof(usa);
   MG_SOCKET_TYPE fd = raccept(FD(lsn), &usa, &sa_len);
-  if (fd == MG_INVALID_SOCKET) {
+  if (fd == MG_INVALID_SOCKET && MG_ENABLE_EPOLL_READY && MG_SOCK_PENDING(-1)) {
+    lsn->is_rready = 0;  // Backlog drained, wait for the next edge
+  } else if (fd == MG_INVALID_SOCKET) {
 #if MG_ARCH == MG_ARCH_THREADX || defined(__ECOS)
     // NetxDuo, in non-block socket mode can mark listening socket readable
     // even it is not. See comment for 'select' func implementation in
@@ -9320,7 +9596,8 @@ static bool can_read(const struct mg_connection *c) {
 }
 
 static bool can_write(const struct mg_connection *c) {
-  return c->is_connecting || (c->send.len > 0 && c->is_tls_hs == 0);
+  return c->is_connecting ||
+         ((c->send.len > 0 || c->sendfile_len > 0) && c->is_tls_hs == 0);
 }
 
 static bool skip_iotest(const struct mg_connection *c) {
@@ -9348,17 +9625,39 @@ static void mg_iotest(struct mg_mgr *mgr, int ms) {
       FreeRTOS_FD_CLR(c->fd, mgr->ss,
                       eSELECT_READ | eSELECT_EXCEPT | eSELECT_WRITE);
   }
+#elif MG_ENABLE_EPOLL_READY
+  // No walk over the connections: each event latches its direction and
+  // queues c, mg_mgr_poll() then dispatches the queue only
+  struct epoll_event evs[MG_EPOLL_MAX_EVENTS];
+  uint64_t now = mg_millis();
+  uint64_t left = mgr->sweep_at > now ? mgr->sweep_at - now : 0;
+  if (mgr->ready_head != NULL) ms = 0;
+  if (ms < 0 || (uint64_t) ms > left) ms = (int) left;  // Sweep is due
+  int n = epoll_wait(mgr->epoll_fd, evs, MG_EPOLL_MAX_EVENTS, ms);
+  for (int i = 0; i < n; i++) {
+    struct mg_connection *c = (struct mg_connection *) evs[i].data.ptr;
+    if (evs[i].events & EPOLLERR) {
+      mg_error(c, "socket error");
+    } else {
+      if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) c->is_rready = 1;
+      if (evs[i].events & EPOLLOUT) c->is_wready = 1;
+      mg_mark(c);
+    }
+  }
+  (void) skip_iotest;
 #elif MG_ENABLE_EPOLL
-  size_t max = 1;
+  // Interest is cached in c->is_epollout, so idle connections cost no
+  // syscall here; epoll_wait() hands back only the ready ones, the rest are
+  // reported by the next call (level-triggered) when more than fit the array
+  struct epoll_event evs[MG_EPOLL_MAX_EVENTS];
   for (struct mg_connection *c = mgr->conns; c != NULL; c = c->next) {
     c->is_readable = c->is_writable = 0;
     if (c->rtls.len > 0 || mg_tls_pending(c) > 0) ms = 1, c->is_readable = 1;
-    if (can_write(c)) MG_EPOLL_MOD(c, 1);
+    if (FD(c) != MG_INVALID_SOCKET && !c->is_resolving)
+      MG_EPOLL_MOD(c, can_write(c));
     if (c->is_closing) ms = 1;
-    max++;
   }
-  struct epoll_event *evs = (struct epoll_event *) alloca(max * sizeof(evs[0]));
-  int n = epoll_wait(mgr->epoll_fd, evs, (int) max, ms);
+  int n = epoll_wait(mgr->epoll_fd, evs, MG_EPOLL_MAX_EVENTS, ms);
   for (int i = 0; i < n; i++) {
     struct mg_connection *c = (struct mg_connection *) evs[i].data.ptr;
     if (evs[i].events & EPOLLERR) {
@@ -9552,6 +9851,74 @@ bool mg_wakeup(struct mg_mgr *mgr, unsigned long conn_id, const void *buf,
   return false;
 }
 
+// One connection's share of a poll pass. False once c has been freed
+static bool mg_dispatch(struct mg_mgr *mgr, struct mg_connection *c,
+                        uint64_t *now) {
+  bool is_resp = c->is_resp;
+  mg_call(c, MG_EV_POLL, now);
+  if (is_resp && !c->is_resp) {
+    long n = 0;
+    mg_call(c, MG_EV_READ, &n);
+  }
+  MG_VERBOSE(("%lu %c%c %c%c%c%c%c %lu %lu", c->id,
+              c->is_readable ? 'r' : '-', c->is_writable ? 'w' : '-',
+              c->is_tls ? 'T' : 't', c->is_connecting ? 'C' : 'c',
+              c->is_tls_hs ? 'H' : 'h', c->is_resolving ? 'R' : 'r',
+              c->is_closing ? 'C' : 'c', mg_tls_pending(c), c->rtls.len));
+  if (c->is_resolving || c->is_closing) {
+    // Do nothing
+  } else if (c->is_listening && c->is_udp == 0) {
+    if (c->is_readable) accept_conn(mgr, c);
+  } else if (c->is_connecting) {
+    if (c->is_readable || c->is_writable) connect_conn(c);
+#if MG_ENABLE_IO_URING
+  } else if (c->is_uring_rx) {
+    uring_conn(c);
+#endif
+  } else {
+    if (c->is_readable) read_conn(c);
+    if (c->is_writable) write_conn(c);
+    if (c->is_tls && !c->is_tls_hs && c->send.len == 0) mg_tls_flush(c);
+  }
+
+  if (c->is_draining && c->send.len == 0 && c->sendfile_len == 0)
+    c->is_closing = 1;
+  if (c->is_closing) {
+    close_conn(c);
+    return false;
+  }
+  return true;
+}
+
+#if MG_ENABLE_EPOLL_READY
+// Latched edges with work left, or TLS records already decrypted
+static bool ready_again(struct mg_connection *c) {
+  return (c->is_rready && can_read(c)) || (c->is_wready && can_write(c)) ||
+         (can_read(c) && (c->rtls.len > 0 || mg_tls_pending(c) > 0));
+}
+
+// O(ready): only queued connections get MG_EV_POLL and I/O, the others are
+// swept every MG_EPOLL_SWEEP_MS for their timeouts. Connections a handler
+// writes to or closes from outside their own dispatch need mg_mark()
+static void mg_poll_ready(struct mg_mgr *mgr, uint64_t now) {
+  struct mg_connection *c;
+  size_t n;
+  if (now >= mgr->sweep_at) {
+    for (c = mgr->conns; c != NULL; c = c->next) mg_mark(c);
+    mgr->sweep_at = now + MG_EPOLL_SWEEP_MS;
+  }
+  // Connections queued while this pass runs wait for the next one
+  for (n = mgr->ready_len; n > 0 && (c = mgr->ready_head) != NULL; n--) {
+    mg_unmark(c);
+    c->is_readable = c->is_rready && can_read(c) ? 1U : 0;
+    c->is_writable = c->is_wready && can_write(c) ? 1U : 0;
+    if (can_read(c) && (c->rtls.len > 0 || mg_tls_pending(c) > 0))
+      c->is_readable = 1;
+    if (mg_dispatch(mgr, c, &now) && ready_again(c)) mg_mark(c);
+  }
+}
+#endif
+
 void mg_mgr_poll(struct mg_mgr *mgr, int ms) {
   struct mg_connection *c, *tmp;
   uint64_t now;
@@ -9559,35 +9926,22 @@ void mg_mgr_poll(struct mg_mgr *mgr, int ms) {
   mg_iotest(mgr, ms);
   now = mg_millis();
   mg_timer_poll(&mgr->timers, now);
+#if MG_ENABLE_EPOLL_READY
+  (void) c, (void) tmp;
+  mg_poll_ready(mgr, now);
+#else
+#if MG_ENABLE_IO_URING
+  if (mgr->uring != NULL) uring_read(mgr);
+#endif
 
   for (c = mgr->conns; c != NULL; c = tmp) {
-    bool is_resp = c->is_resp;
     tmp = c->next;
-    mg_call(c, MG_EV_POLL, &now);
-    if (is_resp && !c->is_resp) {
-      long n = 0;
-      mg_call(c, MG_EV_READ, &n);
-    }
-    MG_VERBOSE(("%lu %c%c %c%c%c%c%c %lu %lu", c->id,
-                c->is_readable ? 'r' : '-', c->is_writable ? 'w' : '-',
-                c->is_tls ? 'T' : 't', c->is_connecting ? 'C' : 'c',
-                c->is_tls_hs ? 'H' : 'h', c->is_resolving ? 'R' : 'r',
-                c->is_closing ? 'C' : 'c', mg_tls_pending(c), c->rtls.len));
-    if (c->is_resolving || c->is_closing) {
-      // Do nothing
-    } else if (c->is_listening && c->is_udp == 0) {
-      if (c->is_readable) accept_conn(mgr, c);
-    } else if (c->is_connecting) {
-      if (c->is_readable || c->is_writable) connect_conn(c);
-    } else {
-      if (c->is_readable) read_conn(c);
-      if (c->is_writable) write_conn(c);
-      if (c->is_tls && !c->is_tls_hs && c->send.len == 0) mg_tls_flush(c);
-    }
-
-    if (c->is_draining && c->send.len == 0) c->is_closing = 1;
-    if (c->is_closing) close_conn(c);
+    mg_dispatch(mgr, c, &now);
   }
+#if MG_ENABLE_IO_URING
+  if (mgr->uring != NULL) uring_write(mgr);
+#endif
+#endif
 }
 #endif
 
@@ -12885,6 +13239,15 @@ void mg_tls_ctx_init(struct mg_mgr *mgr) {
 void mg_tls_ctx_free(struct mg_mgr *mgr) {
   (void) mgr;
 }
+
+void *mg_tls_shared_new(const struct mg_tls_opts *opts) {
+  (void) opts;
+  return NULL;
+}
+
+void mg_tls_shared_free(void *shared) {
+  (void) shared;
+}
 #endif
 
 #ifdef MG_ENABLE_LINES
@@ -14269,6 +14632,13 @@ void mg_tls_ctx_init(struct mg_mgr *mgr) {
 void mg_tls_ctx_free(struct mg_mgr *mgr) {
   (void) mgr;
 }
+void *mg_tls_shared_new(const struct mg_tls_opts *opts) {
+  (void) opts;
+  return NULL;
+}
+void mg_tls_shared_free(void *shared) {
+  (void) shared;
+}
 #endif
 
 #ifdef MG_ENABLE_LINES
@@ -14535,6 +14905,15 @@ void mg_tls_ctx_free(struct mg_mgr *mgr) {
     mgr->tls_ctx = NULL;
   }
 }
+
+void *mg_tls_shared_new(const struct mg_tls_opts *opts) {
+  (void) opts;
+  return NULL;
+}
+
+void mg_tls_shared_free(void *shared) {
+  (void) shared;
+}
 #endif
 
 #ifdef MG_ENABLE_LINES
@@ -14652,12 +15031,81 @@ static void ssl_keylog_cb(const SSL *ssl, const char *line) {
 }
 #endif
 
+#if MG_TLS == MG_TLS_OPENSSL && OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define MG_TLS_SESSIONS 1
+static void mg_tls_session_drop(struct mg_tls_session *s) {
+  SSL_SESSION_free(s->sess);
+  mg_free(s->name);
+  mg_free(s);
+}
+
+// Find a resumable session for this host, expired ones are dropped on the way
+static SSL_SESSION *mg_tls_session_get(struct mg_tls_ctx *ctx,
+                                       const char *name, bool verify) {
+  struct mg_tls_session **p = &ctx->sessions, *s;
+  uint64_t now = (uint64_t) time(NULL);
+  while ((s = *p) != NULL) {
+    uint64_t expire = (uint64_t) SSL_SESSION_get_time(s->sess) +
+                      (uint64_t) SSL_SESSION_get_timeout(s->sess);
+    if (expire <= now || !SSL_SESSION_is_resumable(s->sess)) {
+      *p = s->next, ctx->count--;
+      mg_tls_session_drop(s);
+    } else if (s->verify == verify && strcmp(s->name, name) == 0) {
+      *p = s->next, s->next = ctx->sessions, ctx->sessions = s;  // To front
+      return s->sess;
+    } else {
+      p = &s->next;
+    }
+  }
+  return NULL;
+}
+
+static void mg_tls_session_put(struct mg_tls_ctx *ctx, const char *name,
+                               bool verify, SSL_SESSION *sess) {
+  struct mg_tls_session **p = &ctx->sessions, *s;
+  while ((s = *p) != NULL) {
+    if (s->verify == verify && strcmp(s->name, name) == 0) {
+      *p = s->next, ctx->count--;  // Replaced by the newer ticket
+      mg_tls_session_drop(s);
+    } else {
+      p = &s->next;
+    }
+  }
+  if ((s = (struct mg_tls_session *) mg_calloc(1, sizeof(*s))) == NULL) {
+    SSL_SESSION_free(sess);
+    return;
+  }
+  s->name = mg_mprintf("%s", name);
+  s->verify = verify;
+  s->sess = sess;
+  s->next = ctx->sessions, ctx->sessions = s, ctx->count++;
+  if (ctx->count > MG_TLS_SESSION_CACHE_SIZE) {
+    for (p = &ctx->sessions; (*p)->next != NULL;) p = &(*p)->next;
+    mg_tls_session_drop(*p), *p = NULL, ctx->count--;  // Least recently used
+  }
+}
+
+// TLS 1.3 tickets arrive after the handshake, so sessions are collected here
+static int mg_tls_session_new_cb(SSL *ssl, SSL_SESSION *sess) {
+  struct mg_connection *c = (struct mg_connection *) SSL_get_app_data(ssl);
+  struct mg_tls *tls = c == NULL ? NULL : (struct mg_tls *) c->tls;
+  struct mg_tls_ctx *ctx =
+      c == NULL ? NULL : (struct mg_tls_ctx *) c->mgr->tls_ctx;
+  if (ctx == NULL || tls == NULL || tls->name == NULL) return 0;
+  // Keep a copy: an unclean close marks the live session not resumable
+  if ((sess = SSL_SESSION_dup(sess)) != NULL)
+    mg_tls_session_put(ctx, tls->name, tls->verify, sess);
+  return 0;
+}
+#endif
+
 void mg_tls_free(struct mg_connection *c) {
   struct mg_tls *tls = (struct mg_tls *) c->tls;
   if (tls == NULL) return;
   SSL_free(tls->ssl);
   SSL_CTX_free(tls->ctx);
   BIO_meth_free(tls->bm);
+  mg_free(tls->name);
   mg_free(tls);
   c->tls = NULL;
 }
@@ -14679,15 +15127,20 @@ void mg_tls_init(struct mg_connection *c, const struct mg_tls_opts *opts) {
     s_initialised++;
   }
   MG_DEBUG(("%lu Setting TLS", c->id));
-  tls->ctx = c->is_client ? SSL_CTX_new(TLS_client_method())
-                          : SSL_CTX_new(TLS_server_method());
+  if (opts->shared != NULL) {
+    tls->ctx = (SSL_CTX *) opts->shared;
+    SSL_CTX_up_ref(tls->ctx);
+  } else {
+    tls->ctx = c->is_client ? SSL_CTX_new(TLS_client_method())
+                            : SSL_CTX_new(TLS_server_method());
+#ifdef MG_TLS_SSLKEYLOGFILE
+    if (tls->ctx != NULL) SSL_CTX_set_keylog_callback(tls->ctx, ssl_keylog_cb);
+#endif
+  }
   if (tls->ctx == NULL) {
     mg_error(c, "SSL_CTX_new");
     goto fail;
   }
-#ifdef MG_TLS_SSLKEYLOGFILE
-  SSL_CTX_set_keylog_callback(tls->ctx, ssl_keylog_cb);
-#endif
   if ((tls->ssl = SSL_new(tls->ctx)) == NULL) {
     mg_error(c, "SSL_new");
     goto fail;
@@ -14713,9 +15166,12 @@ void mg_tls_init(struct mg_connection *c, const struct mg_tls_opts *opts) {
     SSL_set_verify(tls->ssl, SSL_VERIFY_NONE, NULL);
   }
 #endif
-  if (opts->ca.buf != NULL && opts->ca.buf[0] != '\0') {
+  if (opts->shared != NULL) {
+    tls->verify = (SSL_CTX_get_verify_mode(tls->ctx) & SSL_VERIFY_PEER) != 0;
+  } else if (opts->ca.buf != NULL && opts->ca.buf[0] != '\0') {
     SSL_set_verify(tls->ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
                    NULL);
+    tls->verify = true;
     STACK_OF(X509_INFO) *certs = load_ca_certs(opts->ca);
     rc = add_ca_certs(tls->ctx, certs);
     sk_X509_INFO_pop_free(certs, X509_INFO_free);
@@ -14756,7 +15212,21 @@ void mg_tls_init(struct mg_connection *c, const struct mg_tls_opts *opts) {
     X509_VERIFY_PARAM_set1_host(SSL_get0_param(tls->ssl), s, 0);
 #endif
     SSL_set_tlsext_host_name(tls->ssl, s);
-    mg_free(s);
+    tls->name = s;
+  }
+#endif
+#ifdef MG_TLS_SESSIONS
+  if (c->is_client && tls->name != NULL && c->mgr->tls_ctx != NULL) {
+    SSL_SESSION *sess = mg_tls_session_get((struct mg_tls_ctx *) c->mgr->tls_ctx,
+                                           tls->name, tls->verify);
+    if (opts->shared == NULL) {  // Shared contexts are set up once
+      SSL_CTX_set_session_cache_mode(
+          tls->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(tls->ctx, mg_tls_session_new_cb);
+    }
+    SSL_set_app_data(tls->ssl, c);
+    if (sess != NULL && SSL_set_session(tls->ssl, sess) == 1)
+      MG_DEBUG(("%lu resuming session for %s", c->id, tls->name));
   }
 #endif
 #if MG_TLS == MG_TLS_WOLFSSL
@@ -14780,11 +15250,59 @@ fail:
   mg_tls_free(c);
 }
 
+void *mg_tls_shared_new(const struct mg_tls_opts *opts) {
+  SSL_CTX *ctx = SSL_CTX_new(TLS_method());
+  const char *id = "mongoose";
+  bool ok = ctx != NULL;
+  if (ok) {
+    SSL_CTX_set_session_id_context(ctx, (const uint8_t *) id,
+                                   (unsigned) strlen(id));
+#ifdef MG_TLS_SESSIONS
+    // Tickets keep server resumption working without the internal store
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_BOTH | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, mg_tls_session_new_cb);
+#endif
+#ifdef MG_TLS_SSLKEYLOGFILE
+    SSL_CTX_set_keylog_callback(ctx, ssl_keylog_cb);
+#endif
+  }
+  if (ok && opts->ca.buf != NULL && opts->ca.buf[0] != '\0') {
+    STACK_OF(X509_INFO) *certs = load_ca_certs(opts->ca);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+                       NULL);
+    ok = certs != NULL && add_ca_certs(ctx, certs);
+    sk_X509_INFO_pop_free(certs, X509_INFO_free);
+    if (!ok) MG_ERROR(("CA err"));
+  }
+  if (ok && opts->cert.buf != NULL && opts->cert.buf[0] != '\0') {
+    X509 *cert = load_cert(opts->cert);
+    ok = cert != NULL && SSL_CTX_use_certificate(ctx, cert) == 1;
+    X509_free(cert);
+    if (!ok) MG_ERROR(("CERT err"));
+  }
+  if (ok && opts->key.buf != NULL && opts->key.buf[0] != '\0') {
+    EVP_PKEY *key = load_key(opts->key);
+    ok = key != NULL && SSL_CTX_use_PrivateKey(ctx, key) == 1 &&
+         SSL_CTX_check_private_key(ctx) == 1;
+    EVP_PKEY_free(key);
+    if (!ok) MG_ERROR(("KEY err"));
+  }
+  ERR_clear_error();
+  if (!ok) SSL_CTX_free(ctx), ctx = NULL;
+  return ctx;
+}
+
+void mg_tls_shared_free(void *shared) {
+  SSL_CTX_free((SSL_CTX *) shared);
+}
+
 void mg_tls_handshake(struct mg_connection *c) {
   struct mg_tls *tls = (struct mg_tls *) c->tls;
   int rc = c->is_client ? SSL_connect(tls->ssl) : SSL_accept(tls->ssl);
   if (rc == 1) {
-    MG_DEBUG(("%lu success", c->id));
+    MG_DEBUG(("%lu success%s", c->id,
+              SSL_session_reused(tls->ssl) ? ", resumed" : ""));
     c->is_tls_hs = 0;
     mg_call(c, MG_EV_TLS_HS, NULL);
   } else {
@@ -14820,11 +15338,27 @@ void mg_tls_flush(struct mg_connection *c) {
 }
 
 void mg_tls_ctx_init(struct mg_mgr *mgr) {
+#if defined(MG_TLS_SESSIONS) && MG_TLS_SESSION_CACHE_SIZE > 0
+  mgr->tls_ctx = mg_calloc(1, sizeof(struct mg_tls_ctx));
+#else
   (void) mgr;
+#endif
 }
 
 void mg_tls_ctx_free(struct mg_mgr *mgr) {
+#ifdef MG_TLS_SESSIONS
+  struct mg_tls_ctx *ctx = (struct mg_tls_ctx *) mgr->tls_ctx;
+  struct mg_tls_session *s;
+  if (ctx == NULL) return;
+  while ((s = ctx->sessions) != NULL) {
+    ctx->sessions = s->next;
+    mg_tls_session_drop(s);
+  }
+  mg_free(ctx);
+  mgr->tls_ctx = NULL;
+#else
   (void) mgr;
+#endif
 }
 #endif
 
@@ -922,6 +922,30 @@ struct timeval {
 #define MG_ENABLE_EPOLL 0
 #endif
 
+#ifndef MG_ENABLE_EPOLL_READY
+#define MG_ENABLE_EPOLL_READY 0  // Edge-triggered epoll, dispatch ready only
+#endif
+
+#ifndef MG_ENABLE_IO_URING
+#define MG_ENABLE_IO_URING 0  // Batch socket recv/send through io_uring
+#endif
+
+#if MG_ENABLE_EPOLL_READY && (!MG_ENABLE_EPOLL || MG_ENABLE_IO_URING)
+#error "MG_ENABLE_EPOLL_READY needs MG_ENABLE_EPOLL, without MG_ENABLE_IO_URING"
+#endif
+
+#ifndef MG_IO_URING_ENTRIES
+#define MG_IO_URING_ENTRIES 256  // io_uring submission queue size
+#endif
+
+#ifndef MG_ENABLE_SENDFILE
+#if defined(__linux__) && MG_ARCH == MG_ARCH_UNIX
+#define MG_ENABLE_SENDFILE 1  // mg_sendfile() through sendfile(2)
+#else
+#define MG_ENABLE_SENDFILE 0
+#endif
+#endif
+
 #ifndef MG_ENABLE_FATFS
 #define MG_ENABLE_FATFS 0
 #endif
@@ -980,6 +1004,14 @@ struct timeval {
 #define MG_DATA_SIZE 32  // struct mg_connection :: data size
 #endif
 
+#ifndef MG_EPOLL_MAX_EVENTS
+#define MG_EPOLL_MAX_EVENTS 1024  // Events fetched per epoll_wait() call
+#endif
+
+#ifndef MG_EPOLL_SWEEP_MS
+#define MG_EPOLL_SWEEP_MS 500  // MG_ENABLE_EPOLL_READY: MG_EV_POLL to all
+#endif
+
 #ifndef MG_MAX_HTTP_HEADERS
 #define MG_MAX_HTTP_HEADERS 30
 #endif
@@ -1020,17 +1052,32 @@ struct timeval {
 #define MG_SOCKET_ERRNO errno
 #endif
 
-#if MG_ENABLE_EPOLL
+#if MG_ENABLE_EPOLL_READY
+// Registered once for both directions, edge-triggered: the kernel reports
+// transitions, c->is_rready / c->is_wready latch them until MG_IO_WAIT
 #define MG_EPOLL_ADD(c)                                                    \
   do {                                                                     \
-    struct epoll_event ev = {EPOLLIN | EPOLLERR | EPOLLHUP, {c}};          \
+    struct epoll_event ev = {EPOLLIN | EPOLLOUT | EPOLLRDHUP, {c}};        \
+    ev.events |= EPOLLET;                                                  \
     epoll_ctl(c->mgr->epoll_fd, EPOLL_CTL_ADD, (int) (size_t) c->fd, &ev); \
   } while (0)
-#define MG_EPOLL_MOD(c, wr)                                                \
+#define MG_EPOLL_MOD(c, wr)
+#elif MG_ENABLE_EPOLL
+#define MG_EPOLL_ADD(c)                                                    \
   do {                                                                     \
     struct epoll_event ev = {EPOLLIN | EPOLLERR | EPOLLHUP, {c}};          \
-    if (wr) ev.events |= EPOLLOUT;                                         \
-    epoll_ctl(c->mgr->epoll_fd, EPOLL_CTL_MOD, (int) (size_t) c->fd, &ev); \
+    epoll_ctl(c->mgr->epoll_fd, EPOLL_CTL_ADD, (int) (size_t) c->fd, &ev); \
+    c->is_epollout = 0;                                                    \
+  } while (0)
+#define MG_EPOLL_MOD(c, wr)                                                  \
+  do {                                                                       \
+    unsigned wr_ = (wr) ? 1U : 0U;                                           \
+    if (c->is_epollout != wr_) { /* syscall only when interest changes */    \
+      struct epoll_event ev = {EPOLLIN | EPOLLERR | EPOLLHUP, {c}};          \
+      if (wr_) ev.events |= EPOLLOUT;                                        \
+      epoll_ctl(c->mgr->epoll_fd, EPOLL_CTL_MOD, (int) (size_t) c->fd, &ev); \
+      c->is_epollout = wr_;                                                  \
+    }                                                                        \
   } while (0)
 #else
 #define MG_EPOLL_ADD(c)
@@ -1481,11 +1528,23 @@ const char *mg_url_uri(const char *url);
 
 
 
+// Replaces mg_calloc/mg_free for connections and their iobufs, see
+// mg_mgr::allocator. Allocations must be zeroed, frees get the size back
+struct mg_allocator {
+  void *(*conn_alloc)(void *ctx, size_t size);
+  void (*conn_free)(void *ctx, void *ptr, size_t size);
+  void *(*buf_alloc)(void *ctx, size_t size);
+  void (*buf_free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+};
+
 struct mg_iobuf {
   unsigned char *buf;  // Pointer to stored data
   size_t size;         // Total size available
   size_t len;          // Current number of bytes
   size_t align;        // Alignment during allocation
+  uint8_t growth;      // 0 fit on add, 1 grow by align, n > 1 grow n times
+  struct mg_allocator *alloc;  // Storage allocator, NULL for mg_calloc
 };
 
 int mg_iobuf_init(struct mg_iobuf *, size_t, size_t);
@@ -1634,6 +1693,13 @@ struct mg_mgr {
   struct mg_tcpip_if *ifp;      // Builtin TCP/IP stack only. Interface pointer
   size_t extraconnsize;         // Builtin TCP/IP stack only. Extra space
   MG_SOCKET_TYPE pipe;          // Socketpair end for mg_wakeup()
+  bool reuseport;               // Set SO_REUSEPORT on listening sockets
+  void *uring;                  // io_uring engine, MG_ENABLE_IO_URING only
+  struct mg_allocator *allocator;  // New connections, NULL for mg_calloc
+  struct mg_connection *ready_head;  // MG_ENABLE_EPOLL_READY dispatch queue
+  struct mg_connection *ready_tail;
+  size_t ready_len;                  // Connections on ready_head
+  uint64_t sweep_at;                 // Next MG_EV_POLL to every connection
 #if MG_ENABLE_FREERTOS_TCP
   SocketSet_t ss;  // NOTE(lsm): referenced from socket struct
 #endif
@@ -1675,9 +1741,26 @@ struct mg_connection {
   unsigned is_resp : 1;           // Response is still being generated
   unsigned is_readable : 1;       // Connection is ready to read
   unsigned is_writable : 1;       // Connection is ready to write
+  unsigned is_epollout : 1;       // EPOLLOUT is registered with epoll
+  unsigned is_uring_rx : 1;       // io_uring recv completed, see uring_rx
+  long uring_rx;                  // io_uring recv result, MG_IO_* on error
+  int sendfile_fd;                // mg_sendfile() source, after send drains
+  uint64_t sendfile_off;          // Next offset in sendfile_fd
+  size_t sendfile_len;            // Bytes of sendfile_fd still to go
+  size_t max_recv;                // Receive buffer cap, 0 for MG_MAX_RECV_SIZE
+  struct mg_allocator *alloc;     // Allocator of this connection
+  unsigned is_send_high : 1;      // send.len crossed the high watermark
+  unsigned is_queued : 1;         // On mgr->ready_head, MG_ENABLE_EPOLL_READY
+  unsigned is_rready : 1;         // Readable edge seen, no MG_IO_WAIT since
+  unsigned is_wready : 1;         // Writable edge seen, no MG_IO_WAIT since
+  struct mg_connection *ready_next;  // Linkage in mgr->ready_head
+  struct mg_connection *ready_prev;
 };
 
+#define MG_RECV_LIMIT(c) ((c)->max_recv > 0 ? (c)->max_recv : MG_MAX_RECV_SIZE)
+
 void mg_mgr_poll(struct mg_mgr *, int ms);
+void mg_mark(struct mg_connection *);  // Dispatch c on the next poll
 void mg_mgr_init(struct mg_mgr *);
 void mg_mgr_free(struct mg_mgr *);
 
@@ -1689,6 +1772,10 @@ struct mg_connection *mg_wrapfd(struct mg_mgr *mgr, int fd,
                                 mg_event_handler_t fn, void *fn_data);
 void mg_connect_resolved(struct mg_connection *);
 bool mg_send(struct mg_connection *, const void *, size_t);
+// Stream len bytes of fd from offset straight to the socket once c->send
+// has drained, MG_EV_WRITE reports progress. fd stays owned by the caller,
+// keep it open until sendfile_len drops to 0. False if c is not plain TCP
+bool mg_sendfile(struct mg_connection *c, int fd, uint64_t offset, size_t len);
 size_t mg_printf(struct mg_connection *, const char *fmt, ...);
 size_t mg_vprintf(struct mg_connection *, const char *fmt, va_list *ap);
 bool mg_aton(struct mg_str str, struct mg_addr *addr);
@@ -1735,6 +1822,7 @@ struct mg_http_serve_opts {
   const char *mime_types;     // Extra mime types, ext1=type1,ext2=type2,..
   const char *page404;        // Path to the 404 page, or NULL by default
   struct mg_fs *fs;           // Filesystem implementation. Use NULL for POSIX
+  bool sendfile;              // POSIX files over plain TCP via mg_sendfile()
 };
 
 // Parameter for mg_http_next_multipart
@@ -1756,6 +1844,9 @@ void mg_http_serve_dir(struct mg_connection *, struct mg_http_message *hm,
                        const struct mg_http_serve_opts *);
 void mg_http_serve_file(struct mg_connection *, struct mg_http_message *hm,
                         const char *path, const struct mg_http_serve_opts *);
+struct mg_str mg_http_content_type(struct mg_str path, const char *mime_types);
+char *mg_http_etag(char *buf, size_t len, size_t size, time_t mtime);
+const char *mg_http_status_code_str(int status_code);
 void mg_http_reply(struct mg_connection *, int status_code, const char *headers,
                    const char *body_fmt, ...);
 struct mg_str *mg_http_get_header(struct mg_http_message *, const char *name);
@@ -1797,9 +1888,14 @@ struct mg_tls_opts {
   struct mg_str key;      // PEM or DER
   struct mg_str name;     // If not empty, enable host name verification
   int skip_verification;  // Skip certificate and host name verification
+  void *shared;           // From mg_tls_shared_new(), ca is then ignored
 };
 
 void mg_tls_init(struct mg_connection *, const struct mg_tls_opts *opts);
+// Parse ca/cert/key once into a context many connections reference.
+// NULL on error or if the TLS backend has no shared contexts
+void *mg_tls_shared_new(const struct mg_tls_opts *opts);
+void mg_tls_shared_free(void *shared);  // Drop a reference
 void mg_tls_free(struct mg_connection *);
 long mg_tls_send(struct mg_connection *, const void *buf, size_t len);
 long mg_tls_recv(struct mg_connection *, void *buf, size_t len);
@@ -2710,10 +2806,29 @@ struct mg_tls {
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
+#ifndef MG_TLS_SESSION_CACHE_SIZE
+#define MG_TLS_SESSION_CACHE_SIZE 64  // Client sessions kept per mgr, 0 = off
+#endif
+
 struct mg_tls {
   BIO_METHOD *bm;
   SSL_CTX *ctx;
   SSL *ssl;
+  char *name;   // SNI host, key into the session cache
+  bool verify;  // Peer certificate is verified
+};
+
+// Client session cache shared by all connections of a mgr, in mgr->tls_ctx
+struct mg_tls_session {
+  struct mg_tls_session *next;
+  char *name;          // SNI host the session was negotiated with
+  bool verify;         // Negotiated with peer verification on
+  SSL_SESSION *sess;   // Owned reference
+};
+
+struct mg_tls_ctx {
+  struct mg_tls_session *sessions;  // Most recently used first
+  size_t count;
 };
 #endif
 
@@ -0,0 +1,72 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/02
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace mg {
+
+/// Lock-free multi-producer single-consumer FIFO (Vyukov).
+/// Push is wait-free and callable from any thread, Pop only from the
+/// owning loop thread.
+template <class T>
+class MpscQueue {
+  struct Node {
+    std::atomic<Node*> next = nullptr;
+    T value;
+  };
+
+ public:
+  MpscQueue() : head_(new Node), tail_(head_.load()) {}
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  ~MpscQueue() {
+    T value;
+    while (Pop(value)) {}
+    delete tail_;
+  }
+
+  void Push(T value) {
+    auto* node = new Node;
+    node->value = std::move(value);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  bool Pop(T& value) {
+    Node* next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return false;
+    /// next becomes the new stub once its value is moved out
+    value = std::move(next->value);
+    delete tail_;
+    tail_ = next;
+    return true;
+  }
+
+ private:
+  std::atomic<Node*> head_;  // producers side
+  Node* tail_;               // consumer side, always a consumed stub
+};
+
+}  // namespace mg
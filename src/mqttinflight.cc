@@ -0,0 +1,160 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/22
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include "mqttinflight.h"
+
+namespace mg {
+
+/// Remaining length of a PUBLISH packet, after the fixed header
+static size_t Remaining(std::string_view topic, std::string_view body,
+                        uint8_t qos, bool mqtt5) {
+  return 2 + topic.size() + (qos ? 2 : 0) + (mqtt5 ? 1 : 0) + body.size();
+}
+
+size_t MqttInflight::EncodeHeader(char* out, uint8_t first, size_t remaining) {
+  size_t n = 0;
+  out[n++] = static_cast<char>(first);
+  do {  // remaining length, 7 bits per byte
+    uint8_t b = remaining % 128;
+    remaining /= 128;
+    out[n++] = static_cast<char>(remaining ? b | 0x80 : b);
+  } while (remaining);
+  return n;
+}
+
+size_t MqttInflight::Size(std::string_view topic, std::string_view body,
+                          uint8_t qos, bool mqtt5) {
+  size_t len = Remaining(topic, body, qos, mqtt5);
+  size_t varint = len < 128 ? 1 : len < 16384 ? 2 : len < 2097152 ? 3 : 4;
+  return 1 + varint + len;
+}
+
+char* MqttInflight::EncodeTo(char* out, std::string_view topic,
+                             std::string_view body, uint8_t qos, bool mqtt5,
+                             bool retain) {
+  uint8_t first = (MQTT_CMD_PUBLISH << 4) | (qos & 3) << 1 | (retain ? 1 : 0);
+  out += EncodeHeader(out, first, Remaining(topic, body, qos, mqtt5));
+  *out++ = static_cast<char>(topic.size() >> 8);
+  *out++ = static_cast<char>(topic.size() & 0xff);
+  memcpy(out, topic.data(), topic.size());
+  out += topic.size();
+  if (qos) {
+    *out++ = '\0';  // packet id
+    *out++ = '\0';
+  }
+  if (mqtt5)
+    *out++ = '\0';  // no properties
+  memcpy(out, body.data(), body.size());
+  return out + body.size();
+}
+
+std::string MqttInflight::Encode(std::string_view topic, std::string_view body,
+                                 uint8_t qos, bool mqtt5, bool retain) {
+  std::string frame(Size(topic, body, qos, mqtt5), '\0');
+  EncodeTo(frame.data(), topic, body, qos, mqtt5, retain);
+  return frame;
+}
+
+bool MqttInflight::Push(std::string frame) {
+  if (queue_.size() >= max_queued_)
+    return false;
+  Entry e = {.frame = std::move(frame)};
+  const auto* p = reinterpret_cast<const uint8_t*>(e.frame.data());
+  e.qos = (p[0] >> 1) & 3;
+  size_t ofs = 1;
+  while (p[ofs++] & 0x80) {
+  }
+  e.id_ofs = static_cast<uint32_t>(ofs + 2 + (p[ofs] << 8 | p[ofs + 1]));
+  queue_.push_back(std::move(e));
+  return true;
+}
+
+void MqttInflight::Pump(struct mg_connection* c) {
+  size_t room = window_ > inflight_ ? window_ - inflight_ : 0;
+  if (room > kMaxIds - sent_.size())
+    room = kMaxIds - sent_.size();
+  size_t bytes = 0;
+  for (size_t i = 0; i < room && i < queue_.size(); i++)
+    bytes += queue_[i].frame.size();
+  if (c->send.size < c->send.len + bytes)
+    mg_iobuf_resize(&c->send, c->send.len + bytes);  // one growth per pump
+  while (!queue_.empty() && inflight_ < window_ && sent_.size() < kMaxIds) {
+    Entry& e = queue_.front();
+    e.id = next_id_++;
+    if (next_id_ == 0)
+      next_id_ = 1;
+    e.frame[e.id_ofs] = static_cast<char>(e.id >> 8);
+    e.frame[e.id_ofs + 1] = static_cast<char>(e.id & 0xff);
+    mg_send(c, e.frame.data(), e.frame.size());
+    sent_.push_back(std::move(e));
+    queue_.pop_front();
+    inflight_++;
+  }
+}
+
+MqttInflight::Entry* MqttInflight::Find(uint16_t id) {
+  if (sent_.empty() || id == 0)
+    return nullptr;
+  uint16_t base = sent_.front().id;
+  size_t ofs = static_cast<uint16_t>(id - base);
+  if (id < base)
+    ofs--;  // ids wrapped past 0, which is never handed out
+  if (ofs >= sent_.size() || sent_[ofs].id != id)
+    return nullptr;
+  return &sent_[ofs];
+}
+
+bool MqttInflight::Ack(uint8_t cmd, uint16_t id) {
+  Entry* e = Find(id);
+  if (!e || e->state == kDone)
+    return false;
+  if (cmd == MQTT_CMD_PUBREC && e->qos == 2 && e->state == kSent) {
+    e->state = kReceived;  // mongoose answers with PUBREL
+    std::string().swap(e->frame);
+    return true;
+  }
+  bool final = (cmd == MQTT_CMD_PUBACK && e->qos == 1) ||
+               (cmd == MQTT_CMD_PUBCOMP && e->qos == 2);
+  if (!final)
+    return false;
+  e->state = kDone;
+  inflight_--;
+  while (!sent_.empty() && sent_.front().state == kDone)
+    sent_.pop_front();
+  return true;
+}
+
+void MqttInflight::Resend(struct mg_connection* c) {
+  for (Entry& e : sent_) {
+    if (e.state == kSent) {
+      e.frame[0] = static_cast<char>(e.frame[0] | 0x08);  // DUP
+      mg_send(c, e.frame.data(), e.frame.size());
+    } else if (e.state == kReceived) {
+      uint8_t rel[4] = {MQTT_CMD_PUBREL << 4 | 2, 2,
+                        static_cast<uint8_t>(e.id >> 8),
+                        static_cast<uint8_t>(e.id & 0xff)};
+      mg_send(c, rel, sizeof(rel));
+    }
+  }
+}
+
+}  // namespace mg
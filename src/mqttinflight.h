@@ -0,0 +1,94 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/22
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include "common.h"
+
+namespace mg {
+
+/// QoS 1/2 PUBLISH packets of one MqttConnect, from the write to the last
+/// acknowledgement. Packets past the window wait in a queue, those in it
+/// stay serialized for retransmission after a reconnect. Packet ids are
+/// handed out in sequence, so an ack finds its entry by offset.
+class MqttInflight {
+ public:
+  MqttInflight(size_t window, size_t max_queued)
+      : window_(window ? window : 1), max_queued_(max_queued) {}
+
+  /// Write a fixed header at out, at most 5 bytes, returns its length
+  static size_t EncodeHeader(char* out, uint8_t first, size_t remaining);
+  /// Bytes of a PUBLISH packet
+  static size_t Size(std::string_view topic, std::string_view body,
+                     uint8_t qos, bool mqtt5);
+  /// Write a PUBLISH packet of Size() bytes at out, packet id zero,
+  /// returns the end
+  static char* EncodeTo(char* out, std::string_view topic,
+                        std::string_view body, uint8_t qos, bool mqtt5,
+                        bool retain = false);
+  /// PUBLISH packet with a zero packet id, filled in when it is sent
+  static std::string Encode(std::string_view topic, std::string_view body,
+                            uint8_t qos, bool mqtt5, bool retain = false);
+
+  /// Queue an encoded QoS 1/2 packet, false when the queue is full
+  bool Push(std::string frame);
+  /// Send queued packets while the window has room
+  void Pump(struct mg_connection* c);
+  /// PUBACK, PUBREC or PUBCOMP, false for an id not in flight
+  bool Ack(uint8_t cmd, uint16_t id);
+  /// Send the whole window again on a new session, PUBLISH with DUP set
+  /// or PUBREL for those already received
+  void Resend(struct mg_connection* c);
+  /// Receive Maximum announced by the broker, lowers the window only
+  void Limit(size_t window) {
+    if (window && window < window_)
+      window_ = window;
+  }
+
+  size_t inflight() const { return inflight_; }
+  size_t queued() const { return queue_.size(); }
+
+ private:
+  static constexpr size_t kMaxIds = 65535;  // packet ids, 0 is invalid
+  enum State : uint8_t { kSent, kReceived, kDone };
+  struct Entry {
+    std::string frame;
+    uint32_t id_ofs = 0;  // offset of the packet id in frame
+    uint16_t id = 0;
+    uint8_t qos = 0;
+    State state = kSent;
+  };
+
+  Entry* Find(uint16_t id);
+
+ private:
+  size_t window_;
+  size_t max_queued_;
+  size_t inflight_ = 0;  // entries of sent_ not done
+  uint16_t next_id_ = 1;
+  std::deque<Entry> sent_;  // in packet id order
+  std::deque<Entry> queue_;
+};
+
+}  // namespace mg
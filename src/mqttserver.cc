@@ -0,0 +1,467 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/24
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include "mqttinflight.h"
+#include "mqtttrie.h"
+#include "server.h"
+
+namespace mg {
+
+/// PUBLISH serialized once and shared by every delivery of it
+struct MqttServer::Packet {
+  using Ptr = std::shared_ptr<const Packet>;
+  std::string frame;     // QoS 0 packet: fixed header, topic, payload
+  std::string head1;     // fixed header of the QoS 1 packet
+  uint32_t topic_ofs;    // topic length field in frame
+  uint32_t payload_ofs;
+  uint8_t qos;           // as published, capped to 1
+
+  static Ptr Make(std::string_view topic, std::string_view payload,
+                  uint8_t qos) {
+    auto p = std::make_shared<Packet>();
+    p->frame = MqttInflight::Encode(topic, payload, 0, false);
+    p->payload_ofs = static_cast<uint32_t>(p->frame.size() - payload.size());
+    p->topic_ofs = static_cast<uint32_t>(p->payload_ofs - topic.size() - 2);
+    char head[5];
+    size_t n = MqttInflight::EncodeHeader(head, MQTT_CMD_PUBLISH << 4 | 1 << 1,
+                                          2 + topic.size() + 2 + payload.size());
+    p->head1.assign(head, n);
+    p->qos = qos;
+    return p;
+  }
+
+  /// Bytes of a delivery at qos
+  size_t Size(uint8_t q) const {
+    return q ? head1.size() + frame.size() - topic_ofs + 2 : frame.size();
+  }
+
+  /// Write a delivery of Size(q) bytes at out
+  void Write(char* out, uint8_t q, bool retain, uint16_t id) const {
+    char* start = out;
+    if (q == 0) {
+      memcpy(out, frame.data(), frame.size());
+    } else {
+      memcpy(out, head1.data(), head1.size());
+      out += head1.size();
+      memcpy(out, frame.data() + topic_ofs, payload_ofs - topic_ofs);
+      out += payload_ofs - topic_ofs;
+      *out++ = static_cast<char>(id >> 8);
+      *out++ = static_cast<char>(id & 0xff);
+      memcpy(out, frame.data() + payload_ofs, frame.size() - payload_ofs);
+    }
+    if (retain)
+      start[0] = static_cast<char>(start[0] | 1);
+  }
+};
+
+/// Client of one connection, owned through c->data
+struct MqttServer::Session {
+  struct Delivery {
+    Packet::Ptr packet;
+    uint8_t qos;
+    bool retain;
+  };
+
+  struct mg_connection* c;
+  uint64_t seen;            // mg_millis of the last read
+  uint16_t keepalive = 0;   // seconds, 0 for none
+  bool connected = false;   // CONNECT accepted
+  uint16_t next_id = 1;
+  std::string client_id;
+  std::vector<std::string> filters;
+  std::deque<Delivery> queue;  // waiting for the send window
+  std::unordered_map<uint16_t, Packet::Ptr> inflight;  // QoS 1, by packet id
+  size_t dropped = 0;          // deliveries past max_queued
+
+  static Session* Of(struct mg_connection* c) {
+    Session* s;
+    memcpy(&s, c->data, sizeof(s));
+    return s;
+  }
+  static void Set(struct mg_connection* c, Session* s) {
+    memcpy(c->data, &s, sizeof(s));
+  }
+};
+
+/// Subscriptions, retained messages and client ids of the broker
+struct MqttServer::Subscriptions {
+  using Subscribers = std::unordered_map<Session*, uint8_t>;  // granted QoS
+  using Trie = MqttTopicTrie<Subscribers>;
+
+  /// Add s under filter, true when it was not there yet
+  bool Add(Session* s, std::string_view filter, uint8_t qos) {
+    auto* subs = trie.Values(filter);
+    if (!subs) {
+      trie.Insert(filter, Subscribers());
+      subs = trie.Values(filter);
+    }
+    auto [it, added] = subs->front().emplace(s, qos);
+    it->second = qos;
+    return added;
+  }
+
+  void Forget(Session* s, std::string_view filter) {
+    auto* subs = trie.Values(filter);
+    if (subs && subs->front().erase(s) && subs->front().empty())
+      trie.Remove(filter);
+  }
+
+  Trie trie;  // one Subscribers per filter
+  std::map<std::string, Packet::Ptr, std::less<>> retained;  // by topic
+  std::unordered_map<std::string, Session*> clients;  // by client id
+};
+
+/// Fields of a packet after its fixed header, ok turns false past the end
+struct Reader {
+  explicit Reader(const struct mg_mqtt_message* mm)
+      : p(reinterpret_cast<const uint8_t*>(mm->dgram.buf)),
+        end(p + mm->dgram.len) {
+    for (p++; p < end && (*p++ & 0x80);) {
+    }
+  }
+  bool More() const { return ok && p < end; }
+  uint8_t U8() {
+    if (end - p < 1)
+      return ok = false;
+    return *p++;
+  }
+  uint16_t U16() {
+    if (end - p < 2)
+      return ok = false;
+    p += 2;
+    return static_cast<uint16_t>(p[-2] << 8 | p[-1]);
+  }
+  std::string_view Str() {
+    size_t len = U16();
+    if (!ok || static_cast<size_t>(end - p) < len) {
+      ok = false;
+      return std::string_view();
+    }
+    p += len;
+    return std::string_view(reinterpret_cast<const char*>(p - len), len);
+  }
+
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok = true;
+};
+
+static constexpr uint64_t kSweepMs = 1000;
+static constexpr uint64_t kConnectMs = 10000;  // CONNECT due after accept
+
+MqttServer::MqttServer(MqttSrvOptions options)
+    : MqttSrvBase(std::move(options), true),
+      subs_(std::make_unique<Subscriptions>()) {
+  EnableSlab(options_.slab);
+  Start();
+}
+
+MqttServer::~MqttServer() {
+  Stop();  // sessions close on the loop while subs_ is alive
+}
+
+void MqttServer::InitLoop() {
+  ILoop::InitLoop();
+  mg_mqtt_listen(&mgr_, options_.url.c_str(), &MqttSrvBase::Callback, this);
+  mg_timer_add(&mgr_, kSweepMs, MG_TIMER_REPEAT, &MqttServer::Sweep, this);
+}
+
+void MqttServer::Handler(struct mg_connection* c, int ev, void* ev_data) {
+  Session* s = Session::Of(c);
+  switch (ev) {
+    case MG_EV_ACCEPT:
+      Session::Set(c, new Session{.c = c, .seen = mg_millis()});
+      break;
+    case MG_EV_READ:
+      if (s)
+        s->seen = mg_millis();
+      break;
+    case MG_EV_MQTT_CMD:
+      if (s)
+        Command(c, static_cast<struct mg_mqtt_message*>(ev_data));
+      break;
+    case MG_EV_MQTT_MSG:
+      if (s)
+        Publish(c, static_cast<struct mg_mqtt_message*>(ev_data));
+      break;
+    case MG_EV_POLL:
+    case MG_EV_WRITE:
+      if (s && !s->queue.empty())
+        Drain(s);
+      break;
+    case MG_EV_CLOSE:
+      if (s)
+        Close(c);
+      break;
+    default:
+      break;
+  }
+  MqttSrvBase::Handler(c, ev, ev_data);  // TLS accept and hooks
+}
+
+void MqttServer::Command(struct mg_connection* c, struct mg_mqtt_message* mm) {
+  Session* s = Session::Of(c);
+  if (!s->connected && mm->cmd != MQTT_CMD_CONNECT) {
+    c->is_closing = 1;  // CONNECT comes first
+    return;
+  }
+  switch (mm->cmd) {
+    case MQTT_CMD_CONNECT:
+      if (s->connected || !Connect(c, mm))
+        c->is_draining = 1;
+      break;
+    case MQTT_CMD_SUBSCRIBE:
+      Subscribe(c, mm);
+      break;
+    case MQTT_CMD_UNSUBSCRIBE:
+      Unsubscribe(c, mm);
+      break;
+    case MQTT_CMD_PUBACK:
+      if (s->inflight.erase(mm->id))
+        Drain(s);
+      break;
+    case MQTT_CMD_PINGREQ:
+      mg_mqtt_pong(c);
+      break;
+    case MQTT_CMD_DISCONNECT:
+      c->is_draining = 1;
+      break;
+    default:
+      break;
+  }
+}
+
+bool MqttServer::Connect(struct mg_connection* c, struct mg_mqtt_message* mm) {
+  Session* s = Session::Of(c);
+  Reader r(mm);
+  std::string_view proto = r.Str();
+  uint8_t level = r.U8(), flags = r.U8();
+  uint16_t keepalive = r.U16();
+  std::string_view id = r.Str();
+  if (flags & 0x04) {  // will topic and message, not published
+    r.Str();
+    r.Str();
+  }
+  if (!r.ok || proto != "MQTT")
+    return false;  // not MQTT 3.1.1 or later, no CONNACK
+  uint8_t rc = 0;
+  if (level != 4) {
+    rc = 1;  // unacceptable protocol version
+  } else if (id.empty() && !(flags & 0x02)) {
+    rc = 2;  // identifier rejected, sessions are not kept
+  }
+  uint8_t ack[4] = {MQTT_CMD_CONNACK << 4, 2, 0, rc};
+  mg_send(c, ack, sizeof(ack));
+  if (rc)
+    return false;
+  s->connected = true;
+  s->keepalive = keepalive;
+  if (!id.empty()) {
+    s->client_id = std::string(id);
+    Session*& slot = subs_->clients[s->client_id];
+    if (slot && slot != s) {
+      slot->c->is_closing = 1;  // taken over by the new connection
+      mg_mark(slot->c);
+    }
+    slot = s;
+  }
+  return true;
+}
+
+void MqttServer::Subscribe(struct mg_connection* c, struct mg_mqtt_message* mm) {
+  Session* s = Session::Of(c);
+  Reader r(mm);
+  uint16_t id = r.U16();
+  std::string codes;
+  std::vector<std::pair<std::string_view, uint8_t>> granted;
+  while (r.More()) {
+    std::string_view filter = r.Str();
+    uint8_t opts = r.U8();
+    if (!r.ok)
+      break;
+    if ((opts & 3) > 2 || !Subscriptions::Trie::Valid(filter)) {
+      codes.push_back(static_cast<char>(0x80));  // failure
+      continue;
+    }
+    uint8_t qos = std::min<uint8_t>(opts & 3, 1);
+    if (subs_->Add(s, filter, qos))
+      s->filters.emplace_back(filter);
+    codes.push_back(static_cast<char>(qos));
+    granted.emplace_back(filter, qos);
+  }
+  if (!r.ok || codes.empty()) {
+    c->is_closing = 1;  // malformed
+    return;
+  }
+  char head[7];
+  size_t n = MqttInflight::EncodeHeader(head, MQTT_CMD_SUBACK << 4 | 0,
+                                        2 + codes.size());
+  head[n++] = static_cast<char>(id >> 8);
+  head[n++] = static_cast<char>(id & 0xff);
+  mg_send(c, head, n);
+  mg_send(c, codes.data(), codes.size());
+  for (auto& [filter, qos] : granted) {
+    for (auto& [topic, p] : subs_->retained) {
+      if (Subscriptions::Trie::Matches(filter, topic))
+        Deliver(s, p, std::min(qos, p->qos), true);
+    }
+  }
+}
+
+void MqttServer::Unsubscribe(struct mg_connection* c,
+                             struct mg_mqtt_message* mm) {
+  Session* s = Session::Of(c);
+  Reader r(mm);
+  uint16_t id = r.U16();
+  while (r.More()) {
+    std::string_view filter = r.Str();
+    if (!r.ok)
+      break;
+    subs_->Forget(s, filter);
+    auto it = std::find(s->filters.begin(), s->filters.end(), filter);
+    if (it != s->filters.end())
+      s->filters.erase(it);
+  }
+  uint8_t ack[4] = {MQTT_CMD_UNSUBACK << 4, 2, static_cast<uint8_t>(id >> 8),
+                    static_cast<uint8_t>(id & 0xff)};
+  mg_send(c, ack, sizeof(ack));
+}
+
+void MqttServer::Publish(struct mg_connection* c, struct mg_mqtt_message* mm) {
+  Session* s = Session::Of(c);
+  std::string_view topic(mm->topic.buf, mm->topic.len);
+  if (!s->connected || topic.empty() ||
+      topic.find_first_of("+#") != std::string_view::npos) {
+    c->is_closing = 1;
+    return;
+  }
+  std::string_view payload(mm->data.buf, mm->data.len);
+  bool retain = mm->dgram.buf[0] & 1;
+  if (options_.on_message) {
+    options_.on_message(this, {.topic = topic, .body = payload, .retain = retain});
+  }
+  auto p = Packet::Make(topic, payload, std::min<uint8_t>(mm->qos, 1));
+  if (retain && options_.retain) {
+    auto it = subs_->retained.find(topic);
+    if (payload.empty()) {
+      if (it != subs_->retained.end())
+        subs_->retained.erase(it);  // empty payload clears
+    } else if (it != subs_->retained.end()) {
+      it->second = p;
+    } else {
+      subs_->retained.emplace(std::string(topic), p);
+    }
+  }
+  subs_->trie.Match(topic, [&](const Subscriptions::Subscribers& subs) {
+    for (auto& [sub, qos] : subs)
+      Deliver(sub, p, std::min(qos, p->qos), false);
+  });
+}
+
+void MqttServer::Deliver(Session* s, const std::shared_ptr<const Packet>& p,
+                         uint8_t qos, bool retain) {
+  if (s->queue.empty() && Send(s, p, qos, retain))
+    return;
+  if (s->queue.size() >= options_.max_queued) {
+    s->dropped++;
+    return;
+  }
+  s->queue.push_back({.packet = p, .qos = qos, .retain = retain});
+}
+
+/// Copy a delivery into c->send while it is under send_window, the rest
+/// stays queued by reference. The copy is bounded by the window and small
+/// next to the kernel's own; it lets one send() carry many deliveries and
+/// is the plaintext TLS encrypts, which writev of shared frames could not.
+bool MqttServer::Send(Session* s, const std::shared_ptr<const Packet>& p,
+                      uint8_t qos, bool retain) {
+  struct mg_connection* c = s->c;
+  if (c->send.len >= options_.send_window)
+    return false;
+  if (qos && s->inflight.size() >= options_.max_inflight)
+    return false;
+  size_t n = p->Size(qos), ofs = c->send.len;
+  if (mg_iobuf_add(&c->send, ofs, nullptr, n) != n)
+    return false;
+  mg_mark(c);  // a subscriber, written from the publisher's dispatch
+  uint16_t id = 0;
+  if (qos) {
+    do {
+      id = s->next_id++;
+      if (s->next_id == 0)
+        s->next_id = 1;
+    } while (s->inflight.count(id));
+    s->inflight.emplace(id, p);
+  }
+  p->Write(reinterpret_cast<char*>(c->send.buf) + ofs, qos, retain, id);
+  return true;
+}
+
+void MqttServer::Drain(Session* s) {
+  while (!s->queue.empty()) {
+    auto& d = s->queue.front();
+    if (!Send(s, d.packet, d.qos, d.retain))
+      return;
+    s->queue.pop_front();
+  }
+}
+
+void MqttServer::Close(struct mg_connection* c) {
+  Session* s = Session::Of(c);
+  for (auto& filter : s->filters)
+    subs_->Forget(s, filter);
+  if (!s->client_id.empty()) {
+    auto it = subs_->clients.find(s->client_id);
+    if (it != subs_->clients.end() && it->second == s)
+      subs_->clients.erase(it);
+  }
+  if (s->dropped) {
+    LOGI("%lu mqtt client %s dropped %zu deliveries", c->id,
+         s->client_id.c_str(), s->dropped);
+  }
+  delete s;
+  Session::Set(c, nullptr);
+}
+
+void MqttServer::Sweep(void* arg) {
+  auto* self = static_cast<MqttServer*>(arg);
+  uint64_t now = mg_millis();
+  for (auto* c = self->mgr_.conns; c != NULL; c = c->next) {
+    if (c->fn != &MqttSrvBase::Callback || c->is_listening)
+      continue;
+    Session* s = Session::Of(c);
+    if (s == nullptr)
+      continue;
+    /// 1.5 times the keep-alive, MQTT 3.1.1 section 3.1.2.10
+    uint64_t limit = s->connected ? s->keepalive * 1500ULL : kConnectMs;
+    if (limit && now - s->seen > limit) {
+      c->is_closing = 1;
+      mg_mark(c);
+    }
+  }
+}
+
+}  // namespace mg
@@ -0,0 +1,254 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/23
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mg {
+
+/// MQTT topic filters to values, one node per topic level, so matching a
+/// topic costs its depth and not the number of filters. Filters may hold
+/// `+` (one level) and a trailing `#` (any levels, the parent included);
+/// topics starting with `$` are not matched by a leading wildcard.
+template <class V>
+class MqttTopicTrie {
+ public:
+  MqttTopicTrie() : nodes_(1) {}
+
+  /// Well-formed subscription filter
+  static bool Valid(std::string_view filter) {
+    if (filter.empty() || filter.size() > 65535)
+      return false;
+    for (size_t pos = 0;;) {
+      size_t end = filter.find('/', pos);
+      std::string_view level = filter.substr(pos, end - pos);
+      if (level.find_first_of("+#") != std::string_view::npos &&
+          level.size() != 1)
+        return false;
+      if (level == "#" && end != std::string_view::npos)
+        return false;  // # ends the filter
+      if (end == std::string_view::npos)
+        return true;
+      pos = end + 1;
+    }
+  }
+
+  /// Add value under filter, false when filter is malformed
+  bool Insert(std::string_view filter, V value) {
+    if (!Valid(filter))
+      return false;
+    uint32_t n = 0;
+    ForEachLevel(filter, [&](std::string_view level) { n = Child(n, level); });
+    nodes_[n].values.push_back(std::move(value));
+    size_++;
+    return true;
+  }
+
+  /// Drop the values of filter pred holds for, returns how many
+  template <class P>
+  size_t Remove(std::string_view filter, P&& pred) {
+    uint32_t n = Find(filter);
+    if (n == 0)
+      return 0;
+    auto& values = nodes_[n].values;
+    size_t before = values.size();
+    for (size_t i = 0; i < values.size();) {
+      if (pred(values[i])) {
+        values[i] = std::move(values.back());
+        values.pop_back();
+      } else {
+        i++;
+      }
+    }
+    size_t removed = before - values.size();
+    size_ -= removed;
+    Prune(n);
+    return removed;
+  }
+  size_t Remove(std::string_view filter) {
+    return Remove(filter, [](const V&) { return true; });
+  }
+
+  /// Values stored under filter taken literally, nullptr if none
+  std::vector<V>* Values(std::string_view filter) {
+    uint32_t n = Find(filter);
+    return n && !nodes_[n].values.empty() ? &nodes_[n].values : nullptr;
+  }
+
+  /// Whether filter matches topic, for a single pair
+  static bool Matches(std::string_view filter, std::string_view topic) {
+    if (!topic.empty() && topic[0] == '$' && !filter.empty() &&
+        (filter[0] == '+' || filter[0] == '#'))
+      return false;
+    size_t f = 0, t = 0;
+    for (;;) {
+      size_t fe = filter.find('/', f), te = topic.find('/', t);
+      std::string_view fl = filter.substr(f, fe - f);
+      if (fl == "#")
+        return true;
+      if (t == std::string_view::npos)
+        return false;  // topic ran out of levels
+      if (fl != "+" && fl != topic.substr(t, te - t))
+        return false;
+      if (fe == std::string_view::npos)
+        return te == std::string_view::npos;
+      f = fe + 1;
+      t = te == std::string_view::npos ? te : te + 1;
+    }
+  }
+
+  /// Call fn with every value whose filter matches topic
+  template <class F>
+  void Match(std::string_view topic, F&& fn) const {
+    Walk(0, topic, 0, fn);
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  struct Node {
+    std::map<std::string, uint32_t, std::less<>> next;  // literal levels
+    uint32_t plus = 0;    // + child, 0 for none
+    uint32_t hash = 0;    // # child, 0 for none
+    uint32_t parent = 0;
+    std::string level;    // under the parent
+    std::vector<V> values;
+  };
+
+  template <class F>
+  static void ForEachLevel(std::string_view s, F&& fn) {
+    for (size_t pos = 0;;) {
+      size_t end = s.find('/', pos);
+      fn(s.substr(pos, end - pos));
+      if (end == std::string_view::npos)
+        return;
+      pos = end + 1;
+    }
+  }
+
+  /// Child of n for level, created if missing
+  uint32_t Child(uint32_t n, std::string_view level) {
+    if (level == "+" && nodes_[n].plus)
+      return nodes_[n].plus;
+    if (level == "#" && nodes_[n].hash)
+      return nodes_[n].hash;
+    if (level != "+" && level != "#") {
+      auto it = nodes_[n].next.find(level);
+      if (it != nodes_[n].next.end())
+        return it->second;
+    }
+    uint32_t c;
+    if (!free_.empty()) {
+      c = free_.back();
+      free_.pop_back();
+    } else {
+      c = static_cast<uint32_t>(nodes_.size());
+      nodes_.emplace_back();
+    }
+    nodes_[c].parent = n;
+    nodes_[c].level = std::string(level);
+    if (level == "+")
+      nodes_[n].plus = c;
+    else if (level == "#")
+      nodes_[n].hash = c;
+    else
+      nodes_[n].next.emplace(std::string(level), c);
+    return c;
+  }
+
+  /// Node of filter taken literally, 0 if absent
+  uint32_t Find(std::string_view filter) const {
+    uint32_t n = 0;
+    bool found = true;
+    ForEachLevel(filter, [&](std::string_view level) {
+      if (!found)
+        return;
+      const Node& node = nodes_[n];
+      if (level == "+") {
+        n = node.plus;
+      } else if (level == "#") {
+        n = node.hash;
+      } else {
+        auto it = node.next.find(level);
+        n = it == node.next.end() ? 0 : it->second;
+      }
+      found = n != 0;
+    });
+    return found ? n : 0;
+  }
+
+  /// Recycle n and its ancestors once they hold nothing
+  void Prune(uint32_t n) {
+    while (n != 0) {
+      Node& node = nodes_[n];
+      if (!node.values.empty() || !node.next.empty() || node.plus || node.hash)
+        return;
+      uint32_t parent = node.parent;
+      Node& p = nodes_[parent];
+      if (p.plus == n)
+        p.plus = 0;
+      else if (p.hash == n)
+        p.hash = 0;
+      else
+        p.next.erase(node.level);
+      node.level.clear();
+      free_.push_back(n);
+      n = parent;
+    }
+  }
+
+  /// Match the levels of topic from pos on below n, npos once all are used
+  template <class F>
+  void Walk(uint32_t n, std::string_view topic, size_t pos, F& fn) const {
+    const Node& node = nodes_[n];
+    bool system = n == 0 && !topic.empty() && topic[0] == '$';
+    if (node.hash && !system) {
+      for (const V& v : nodes_[node.hash].values)
+        fn(v);
+    }
+    if (pos == std::string_view::npos) {
+      for (const V& v : node.values)
+        fn(v);
+      return;
+    }
+    size_t end = topic.find('/', pos);
+    std::string_view level = topic.substr(pos, end - pos);
+    size_t next = end == std::string_view::npos ? end : end + 1;
+    auto it = node.next.find(level);
+    if (it != node.next.end())
+      Walk(it->second, topic, next, fn);
+    if (node.plus && !system)
+      Walk(node.plus, topic, next, fn);
+  }
+
+ private:
+  std::vector<Node> nodes_;  // nodes_[0] is the root
+  std::vector<uint32_t> free_;  // recycled node slots
+  size_t size_ = 0;
+};
+
+}  // namespace mg
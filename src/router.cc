@@ -0,0 +1,267 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/14
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include "common.h"
+#include "router.h"
+
+namespace mg {
+
+void HttpResponse::Reply(int status, std::string_view body,
+                         const HttpHeaders& headers) {
+  if (replied_)
+    return;
+  replied_ = true;
+  if (poster_) {
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " +
+                           mg_http_status_code_str(status) + "\r\n";
+    for (auto& [name, value] : headers)
+      response += name + ": " + value + "\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    response += body;
+    poster_->Post(std::move(response));
+    return;
+  }
+  mg_printf(c_, "HTTP/1.1 %d %s\r\n", status, mg_http_status_code_str(status));
+  for (auto& [name, value] : headers) {
+    mg_printf(c_, "%.*s: %.*s\r\n", (int)name.size(), name.data(),
+              (int)value.size(), value.data());
+  }
+  mg_printf(c_, "Content-Length: %lu\r\n\r\n", (unsigned long)body.size());
+  mg_send(c_, body.data(), body.size());
+  c_->is_resp = 0;
+}
+
+HttpFileSink::HttpFileSink(std::string path)
+    : path_(std::move(path)),
+      fd_(open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) {
+  if (fd_ < 0)
+    LOGE("upload open %s: %d", path_.c_str(), errno);
+}
+
+HttpFileSink::~HttpFileSink() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+long HttpFileSink::Write(std::string_view chunk) {
+  if (fd_ < 0)
+    return -1;
+  size_t n = 0;
+  while (n < chunk.size()) {
+    ssize_t r = write(fd_, chunk.data() + n, chunk.size() - n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0) {
+      LOGE("upload write %s: %d", path_.c_str(), errno);
+      return -1;
+    }
+    n += r;
+  }
+  size_ += n;
+  return static_cast<long>(n);
+}
+
+void HttpFileSink::Finish(HttpResponse& res) {
+  bool ok = close(fd_) == 0;
+  fd_ = -1;
+  if (ok) {
+    res.Reply(201, std::to_string(size_) + "\n");
+  } else {
+    unlink(path_.c_str());
+    res.Reply(500);
+  }
+}
+
+void HttpFileSink::Abort() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  unlink(path_.c_str());
+}
+
+bool HttpRouter::Add(std::string_view method, std::string_view pattern,
+                     Handler handler) {
+  return handler && Insert(method, pattern, Route{.handler = std::move(handler)});
+}
+
+bool HttpRouter::Upload(std::string_view method, std::string_view pattern,
+                        Opener opener) {
+  if (!opener || !Insert(method, pattern, Route{.opener = std::move(opener)}))
+    return false;
+  uploads_ = true;
+  return true;
+}
+
+bool HttpRouter::Insert(std::string_view method, std::string_view pattern,
+                        Route route) {
+  if (pattern.empty() || pattern[0] != '/')
+    return false;
+  uint32_t n = 0;
+  size_t params = 0;
+  while (!pattern.empty()) {
+    if (pattern[0] == ':' || pattern[0] == '*') {
+      bool wildcard = pattern[0] == '*';
+      size_t end = wildcard ? pattern.size() : pattern.find('/');
+      if (end == std::string_view::npos)
+        end = pattern.size();
+      if (end < 2 || ++params > HttpParams::kMax ||
+          pattern.substr(1, end - 1).find('/') != std::string_view::npos)
+        return false;  // unnamed, too many to capture, or * not trailing
+      if ((n = AddParam(n, wildcard, pattern.substr(1, end - 1))) == 0)
+        return false;  // same position already named differently
+      pattern.remove_prefix(end);
+    } else {
+      size_t end = pattern.find_first_of(":*");
+      if (end == std::string_view::npos)
+        end = pattern.size();
+      n = AddStatic(n, pattern.substr(0, end));
+      pattern.remove_prefix(end);
+    }
+  }
+  for (auto& [m, h] : nodes_[n].handlers) {
+    if (m == method)
+      return false;  // registered twice
+  }
+  nodes_[n].handlers.emplace_back(std::string(method), std::move(route));
+  return true;
+}
+
+uint32_t HttpRouter::AddStatic(uint32_t n, std::string_view text) {
+  while (!text.empty()) {
+    uint32_t child = 0;
+    size_t slot = 0;
+    for (; slot < nodes_[n].statics.size(); slot++) {
+      if (nodes_[nodes_[n].statics[slot]].prefix[0] == text[0]) {
+        child = nodes_[n].statics[slot];
+        break;
+      }
+    }
+    if (child == 0) {
+      child = static_cast<uint32_t>(nodes_.size());
+      nodes_.emplace_back().prefix = text;
+      nodes_[n].statics.push_back(child);
+      return child;
+    }
+    const std::string& prefix = nodes_[child].prefix;
+    size_t common = 0;
+    while (common < prefix.size() && common < text.size() &&
+           prefix[common] == text[common])
+      common++;
+    if (common < prefix.size()) {
+      /// split child, the shared head becomes a node of its own
+      uint32_t head = static_cast<uint32_t>(nodes_.size());
+      nodes_.emplace_back();
+      nodes_[head].prefix = nodes_[child].prefix.substr(0, common);
+      nodes_[head].statics.push_back(child);
+      nodes_[child].prefix.erase(0, common);
+      nodes_[n].statics[slot] = head;
+      child = head;
+    }
+    text.remove_prefix(common);
+    n = child;
+  }
+  return n;
+}
+
+uint32_t HttpRouter::AddParam(uint32_t n, bool wildcard, std::string_view name) {
+  uint32_t child = wildcard ? nodes_[n].wildcard : nodes_[n].param;
+  if (child != 0)
+    return nodes_[child].name == name ? child : 0;
+  child = static_cast<uint32_t>(nodes_.size());
+  nodes_.emplace_back().name = name;
+  (wildcard ? nodes_[n].wildcard : nodes_[n].param) = child;
+  return child;
+}
+
+const HttpRouter::Route* HttpRouter::Match(std::string_view method,
+                                           std::string_view path,
+                                           HttpParams& params,
+                                           bool* allowed) const {
+  bool found = false;
+  params.size_ = 0;
+  auto* h = Find(0, method, path, params, found);
+  if (allowed)
+    *allowed = h != nullptr || !found;
+  return h;
+}
+
+/// path is what is left once node n matched, literals are tried before
+/// :name and :name before *name, backtracking when a branch dead-ends
+const HttpRouter::Route* HttpRouter::Find(uint32_t n, std::string_view method,
+                                          std::string_view path,
+                                          HttpParams& params,
+                                          bool& found) const {
+  const Node& node = nodes_[n];
+  if (path.empty()) {
+    if (auto* h = Pick(node, method, found); h)
+      return h;
+  } else {
+    for (uint32_t s : node.statics) {
+      const std::string& prefix = nodes_[s].prefix;
+      if (prefix[0] != path[0])
+        continue;
+      if (path.compare(0, prefix.size(), prefix) == 0) {
+        if (auto* h = Find(s, method, path.substr(prefix.size()), params,
+                           found);
+            h)
+          return h;
+      }
+      break;  // first chars are distinct
+    }
+    if (node.param && path[0] != '/') {
+      size_t end = std::min(path.find('/'), path.size());
+      params.fields_[params.size_++] = {nodes_[node.param].name,
+                                        path.substr(0, end)};
+      if (auto* h = Find(node.param, method, path.substr(end), params, found);
+          h)
+        return h;
+      params.size_--;
+    }
+  }
+  if (node.wildcard) {
+    params.fields_[params.size_++] = {nodes_[node.wildcard].name, path};
+    if (auto* h = Pick(nodes_[node.wildcard], method, found); h)
+      return h;
+    params.size_--;
+  }
+  return nullptr;
+}
+
+const HttpRouter::Route* HttpRouter::Pick(const Node& node,
+                                          std::string_view method,
+                                          bool& found) const {
+  const Route* any = nullptr;
+  for (auto& [m, h] : node.handlers) {
+    if (m == method)
+      return &h;
+    if (m.empty())
+      any = &h;
+  }
+  found = found || !node.handlers.empty();
+  return any;
+}
+
+}  // namespace mg
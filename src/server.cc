@@ -19,29 +19,439 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include "chunked.h"
+#include "mpsc.h"
 #include "server.h"
+#include "staticcache.h"
+#include "workpool.h"
 
 namespace mg {
 
+/// handler_threads side of one loop, reached through mgr->userdata and
+/// shared with the responses still held by handlers
+struct HttpServer::Replies : std::enable_shared_from_this<Replies> {
+  struct Reply {
+    unsigned long id;
+    std::string data;
+  };
+  struct Waiting {
+    struct mg_connection* c;
+    bool close;  // Connection: close
+  };
+
+  /// Wake the loop to deliver, callable from any thread
+  void Wake() {
+    std::lock_guard<std::mutex> guard(mtx);
+    if (ready)
+      wakeup();
+  }
+  /// Start waking the loop through wake, callable from any thread
+  void Open(std::function<void()> wake) {
+    std::lock_guard<std::mutex> guard(mtx);
+    wakeup = std::move(wake);
+    ready = true;
+  }
+  /// Stop waking the loop before it goes away, callable from any thread
+  void Close() {
+    std::lock_guard<std::mutex> guard(mtx);
+    ready = false;
+  }
+
+  std::mutex mtx;
+  std::function<void()> wakeup;
+  bool ready = false;  // wakeup set and the loop alive, under mtx
+  MpscQueue<Reply> queue;
+  /// loop thread only
+  std::unordered_map<unsigned long, Waiting> waiting;  // by connection id
+  std::deque<std::shared_ptr<Job>> parked;             // refused by the pool
+};
+
+/// Routed request copied out of the receive buffer for a handler thread
+struct HttpServer::Job {
+  std::string raw;
+  HttpHeaderView::Field fields[MG_MAX_HTTP_HEADERS];
+  HttpRequest req;
+  const HttpRouter::Handler* handler;
+  std::shared_ptr<Replies> replies;
+  unsigned long id;
+
+  void Run();
+};
+
+class HttpServer::AsyncReply : public HttpResponse::Poster {
+ public:
+  AsyncReply(std::shared_ptr<Replies> replies, unsigned long id)
+      : replies_(std::move(replies)), id_(id) {}
+  virtual ~AsyncReply() {
+    if (!posted_)
+      Post("HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+  }
+
+  virtual bool Post(std::string response) override {
+    if (posted_.exchange(true))
+      return false;
+    replies_->queue.Push({.id = id_, .data = std::move(response)});
+    replies_->Wake();
+    return true;
+  }
+
+ private:
+  std::shared_ptr<Replies> replies_;
+  unsigned long id_;
+  std::atomic<bool> posted_ = false;
+};
+
+void HttpServer::Job::Run() {
+  HttpResponse res(std::make_shared<AsyncReply>(replies, id));
+  (*handler)(req, res);
+}
+
+/// Request body being streamed into a sink, owned through c->data while
+/// http_cb is detached from the connection
+struct HttpServer::Upload {
+  HttpBodySink::Ptr sink;
+  mg_event_handler_t pfn;  // http_cb, back once the body is in
+  BodyStream body;
+  bool close;  // Connection: close
+
+  static Upload* Of(struct mg_connection* c) {
+    Upload* u;
+    memcpy(&u, c->data, sizeof(u));
+    return u;
+  }
+  static void Set(struct mg_connection* c, Upload* u) {
+    memcpy(c->data, &u, sizeof(u));
+  }
+};
+
+/// Extra loop owning its own SO_REUSEPORT listener on the server url
+class HttpServer::Worker : public ILoop {
+ public:
+  Worker(HttpServer* server, Replies* replies)
+      : server_(server), replies_(replies) {
+    replies_->Open([this] { Wakeup(); });
+    EnableSlab(server_->options_.slab);
+    Start();
+  }
+  virtual ~Worker() { Stop(); }
+
+  using ILoop::Quit;
+  using ILoop::Stop;
+
+ private:
+  virtual void InitLoop() override {
+    ILoop::InitLoop();
+    mgr_.reuseport = true;
+    mgr_.userdata = replies_;
+    mg_http_listen(&mgr_, server_->options_.url.data(), &HttpServer::Callback,
+                   server_);
+  }
+
+  virtual bool EventLoop() override {
+    server_->Deliver(*replies_);
+    return Poll();
+  }
+
+ private:
+  HttpServer* server_;
+  Replies* replies_;
+};
+
 HttpServer::HttpServer(HttpSrvOptions options)
-    : HttpSrvBase(std::move(options)) {}
+    : HttpSrvBase(std::move(options), true) {
+  if (options_.cache.enable && !options_.serve_dir.empty()) {
+    cache_ = std::make_unique<StaticCache>(options_.serve_dir, options_.cache);
+  }
+  /// every loop exists before the pool can call back into one
+  for (size_t i = 0; i < std::max<size_t>(options_.workers, 1); i++) {
+    replies_.emplace_back(std::make_shared<Replies>());
+  }
+  if (options_.handler_threads > 0) {
+    pool_ = std::make_unique<WorkPool>(
+        options_.handler_threads, std::max<size_t>(options_.handler_queue, 1),
+        [this] {
+          for (auto& r : replies_)
+            r->Wake();  // retry parked requests
+        });
+  }
+  for (size_t i = 1; i < options_.workers; i++) {
+    workers_.emplace_back(std::make_unique<Worker>(this, replies_[i].get()));
+  }
+  replies_[0]->Open([this] { Wakeup(); });
+  EnableSlab(options_.slab);
+  Start();
+}
 HttpServer::~HttpServer() {
+  /// Let every loop drain in parallel, then join them
+  for (auto& w : workers_) {
+    w->Quit();
+  }
+  Quit();
   Stop();
+  for (auto& w : workers_) {
+    w->Stop();
+  }
+  /// no loop submits anymore, replies posted from now on land in queues
+  /// nobody drains and wake no one
+  for (auto& r : replies_) {
+    r->Close();
+  }
+  pool_.reset();
+  workers_.clear();
 }
+SlabStats HttpServer::MemoryStats() const {
+  SlabStats stats = ILoop::MemoryStats();
+  for (auto& w : workers_)
+    stats += w->MemoryStats();
+  return stats;
+}
+
 void HttpServer::Handler(struct mg_connection* c, int ev, void* ev_data) {
-  if (ev == MG_EV_HTTP_MSG) {
+  if (Upload::Of(c) != nullptr) {
+    if (ev == MG_EV_READ || ev == MG_EV_POLL) {
+      Feed(c);
+      return;
+    }
+    if (ev == MG_EV_CLOSE)
+      EndUpload(c, 0);
+  }
+  if (ev == MG_EV_HTTP_HDRS) {
+    auto* hm = static_cast<struct mg_http_message*>(ev_data);
+    if (options_.router.uploads())
+      StartUpload(c, hm);
+  } else if (ev == MG_EV_HTTP_MSG) {
     auto* hm = static_cast<struct mg_http_message*>(ev_data);
-    if (!options_.serve_dir.empty()) {
-      struct mg_http_serve_opts opts = {.root_dir = options_.serve_dir.c_str()};
-      mg_http_serve_dir(c, hm, &opts);
+    if (!options_.router.empty() && Route(c, hm)) {
+      // answered by a route
+    } else if (!options_.serve_dir.empty()) {
+      if (!cache_ || !cache_->Serve(c, hm)) {
+        struct mg_http_serve_opts opts = {
+            .root_dir = options_.serve_dir.c_str(),
+            .sendfile = options_.sendfile};
+        mg_http_serve_dir(c, hm, &opts);
+      }
       LOGI("serve dir:%s, uri:%.*s", options_.serve_dir.c_str(),
            (int)hm->uri.len, hm->uri.buf);
+    } else {
+      mg_http_reply(c, 404, "", "Not found\n");
+    }
+  } else {
+    if (ev == MG_EV_CLOSE && pool_) {
+      static_cast<Replies*>(c->mgr->userdata)->waiting.erase(c->id);
+    }
+    IServer<HttpSrvOptions>::Handler(c, ev, ev_data);  // TLS accept and hooks
+  }
+}
+
+/// Run the route matching hm, false to fall back to serve_dir
+bool HttpServer::Route(struct mg_connection* c, struct mg_http_message* hm) {
+  HttpRequest req = {.method = std::string_view(hm->method.buf, hm->method.len),
+                     .path = std::string_view(hm->uri.buf, hm->uri.len),
+                     .query = std::string_view(hm->query.buf, hm->query.len),
+                     .body = std::string_view(hm->body.buf, hm->body.len)};
+  bool allowed = true;
+  auto* route = options_.router.Match(req.method, req.path, req.params,
+                                      &allowed);
+  if (route == nullptr) {
+    if (allowed)
+      return false;
+    mg_http_reply(c, 405, "", "Method not allowed\n");
+    return true;
+  }
+  if (!route->handler)
+    return false;  // upload route, the connection closed before the body
+  auto* handler = &route->handler;
+  if (pool_) {
+    Dispatch(c, hm, handler, req);
+    return true;
+  }
+  HttpHeaderView::Field fields[MG_MAX_HTTP_HEADERS];
+  req.headers = ViewHeaders(hm, fields);
+  HttpResponse res(c);
+  (*handler)(req, res);
+  if (!res.Replied())
+    mg_http_reply(c, 500, "", "");
+  return true;
+}
+
+/// Hand the request to the pool, c keeps is_resp set so pipelined requests
+/// wait, and stops being read while the pool refuses work
+void HttpServer::Dispatch(struct mg_connection* c, struct mg_http_message* hm,
+                          const HttpRouter::Handler* handler,
+                          const HttpRequest& req) {
+  auto* replies = static_cast<Replies*>(c->mgr->userdata);
+  auto job = std::make_shared<Job>();
+  job->raw.assign(hm->message.buf, hm->message.len);
+  auto rebase = [&](std::string_view v) {
+    return v.empty() ? std::string_view()
+                     : std::string_view(job->raw.data() +
+                                            (v.data() - hm->message.buf),
+                                        v.size());
+  };
+  job->req.method = rebase(req.method);
+  job->req.path = rebase(req.path);
+  job->req.query = rebase(req.query);
+  job->req.body = rebase(req.body);
+  job->req.params = req.params;
+  for (auto& [name, value] : job->req.params.fields_)
+    value = rebase(value);
+  job->req.headers = ViewHeaders(hm, job->fields);
+  for (size_t i = 0; i < job->req.headers.size(); i++) {
+    job->fields[i] = {rebase(job->fields[i].first),
+                      rebase(job->fields[i].second)};
+  }
+  job->handler = handler;
+  job->replies = replies->shared_from_this();
+  job->id = c->id;
+
+  struct mg_str* cc = mg_http_get_header(hm, "Connection");
+  replies->waiting[c->id] = {
+      .c = c, .close = cc && mg_strcasecmp(*cc, mg_str("close")) == 0};
+  if (!replies->parked.empty() || !pool_->Submit([job] { job->Run(); })) {
+    replies->parked.emplace_back(std::move(job));
+    c->is_full = 1;
+  }
+}
+
+/// Take over a request routed to an upload before its body is buffered,
+/// false to let http_cb go on with it
+bool HttpServer::StartUpload(struct mg_connection* c,
+                             struct mg_http_message* hm) {
+  HttpRequest req = {.method = std::string_view(hm->method.buf, hm->method.len),
+                     .path = std::string_view(hm->uri.buf, hm->uri.len),
+                     .query = std::string_view(hm->query.buf, hm->query.len)};
+  auto* route = options_.router.Match(req.method, req.path, req.params);
+  if (route == nullptr || !route->opener)
+    return false;
+  struct mg_str* te = mg_http_get_header(hm, "Transfer-Encoding");
+  bool chunked = te && mg_strcasecmp(*te, mg_str("chunked")) == 0;
+  if (te && !chunked)
+    return false;  // http_cb rejects it
+  HttpHeaderView::Field fields[MG_MAX_HTTP_HEADERS];
+  req.headers = ViewHeaders(hm, fields);
+  HttpResponse res(c);
+  auto sink = route->opener(req, res);
+  /// Changing recv detaches http_cb, requests answered before go too
+  size_t head = static_cast<size_t>(hm->head.buf - (char*)c->recv.buf) +
+                hm->head.len;
+  if (!sink) {
+    if (!res.Replied())
+      mg_http_reply(c, 500, "", "");
+    c->is_draining = 1;  // the body is not read
+    c->recv.len = 0;
+    return true;
+  }
+  auto* u = new Upload{
+      .sink = std::move(sink),
+      .pfn = c->pfn,
+      .body = chunked ? BodyStream(BodyStream::kChunked)
+              : mg_http_get_header(hm, "Content-Length")
+                  ? BodyStream(BodyStream::kLength, hm->body.len)
+                  : BodyStream()};
+  struct mg_str* cc = mg_http_get_header(hm, "Connection");
+  u->close = cc && mg_strcasecmp(*cc, mg_str("close")) == 0;
+  struct mg_str* expect = mg_http_get_header(hm, "Expect");
+  if (expect && mg_strcasecmp(*expect, mg_str("100-continue")) == 0)
+    mg_printf(c, "HTTP/1.1 100 Continue\r\n\r\n");
+  Upload::Set(c, u);
+  mg_iobuf_del(&c->recv, 0, head);
+  return true;
+}
+
+/// Hand received body bytes to the sink, reading stops while it is full
+void HttpServer::Feed(struct mg_connection* c) {
+  Upload* u = Upload::Of(c);
+  auto status = u->body.Feed(
+      c, [u](std::string_view data) { return u->sink->Write(data); });
+  switch (status) {
+    case BodyStream::kMore:
+      return;
+    case BodyStream::kDone:
+      EndUpload(c, 200);
+      return;
+    case BodyStream::kMalformed:
+      EndUpload(c, 400);
+      return;
+    case BodyStream::kAborted:
+      EndUpload(c, 500);
+      return;
+  }
+}
+
+/// 200 once the body is complete, the sink answers; 0 when the connection
+/// is gone; an error status otherwise, answered here
+void HttpServer::EndUpload(struct mg_connection* c, int status) {
+  std::unique_ptr<Upload> u(Upload::Of(c));
+  Upload::Set(c, nullptr);
+  u->body.Stop(c);
+  if (status != 200) {
+    u->sink->Abort();
+    if (status != 0) {
+      mg_http_reply(c, status, "", "");
+      c->is_draining = 1;
+      c->recv.len = 0;
     }
+    return;
+  }
+  HttpResponse res(c);
+  u->sink->Finish(res);
+  if (!res.Replied())
+    mg_http_reply(c, 500, "", "");
+  c->pfn = u->pfn;
+  if (u->close) {
+    c->is_draining = 1;
+  } else if (c->recv.len > 0) {
+    long n = 0;
+    mg_call(c, MG_EV_READ, &n);  // parse requests pipelined meanwhile
   }
 }
 
+/// Loop thread: write posted replies and retry requests the pool refused
+void HttpServer::Deliver(Replies& replies) {
+  if (!pool_)
+    return;
+  for (Replies::Reply reply; replies.queue.Pop(reply);) {
+    auto it = replies.waiting.find(reply.id);
+    if (it == replies.waiting.end())
+      continue;  // closed meanwhile
+    auto [c, close] = it->second;
+    replies.waiting.erase(it);
+    mg_send(c, reply.data.data(), reply.data.size());
+    c->is_resp = 0;
+    if (close) {
+      c->is_draining = 1;
+    } else if (c->recv.len > 0) {
+      long n = 0;
+      mg_call(c, MG_EV_READ, &n);  // parse requests pipelined meanwhile
+    }
+  }
+  while (!replies.parked.empty()) {
+    auto job = replies.parked.front();
+    auto it = replies.waiting.find(job->id);
+    if (it != replies.waiting.end()) {
+      if (!pool_->Submit([job] { job->Run(); }))
+        break;
+      it->second.c->is_full = 0;
+      mg_mark(it->second.c);
+    }
+    replies.parked.pop_front();
+  }
+}
+
+bool HttpServer::EventLoop() {
+  Deliver(*replies_[0]);
+  return Poll();
+}
+
 void HttpServer::InitLoop() {
   ILoop::InitLoop();
+  mgr_.userdata = replies_[0].get();
+  mgr_.reuseport = options_.workers > 1;
   mg_http_listen(&mgr_, options_.url.data(), &IServer::Callback, this);
 }
 
@@ -0,0 +1,159 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/20
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include "slab.h"
+
+namespace mg {
+
+SlabAllocator::SlabAllocator(const SlabOptions& options) : options_(options) {
+  options_.conns_per_slab = std::max<size_t>(options_.conns_per_slab, 1);
+  ops_ = {
+      .conn_alloc = [](void* ctx, size_t size) {
+        return static_cast<SlabAllocator*>(ctx)->ConnAlloc(size);
+      },
+      .conn_free = [](void* ctx, void* ptr, size_t size) {
+        static_cast<SlabAllocator*>(ctx)->ConnFree(ptr, size);
+      },
+      .buf_alloc = [](void* ctx, size_t size) {
+        return static_cast<SlabAllocator*>(ctx)->BufAlloc(size);
+      },
+      .buf_free = [](void* ctx, void* ptr, size_t size) {
+        static_cast<SlabAllocator*>(ctx)->BufFree(ptr, size);
+      },
+      .ctx = this};
+  size_t n = 0;
+  while ((size_t{1} << (kMinShift + n)) < options_.max_class)
+    n++;
+  classes_.assign(n + 1, nullptr);
+}
+
+SlabAllocator::~SlabAllocator() {
+  for (auto* head : classes_) {
+    while (head) {
+      Free* next = head->next;
+      free(head);
+      head = next;
+    }
+  }
+  for (void* slab : slabs_)
+    free(slab);
+}
+
+SlabStats SlabAllocator::Stats() const {
+  return SlabStats{.conns = live_conns_.Get(),
+                   .conn_allocs = conn_allocs_.Get(),
+                   .conn_reused = conn_reused_.Get(),
+                   .slabs = slab_count_.Get(),
+                   .buffers = live_bufs_.Get(),
+                   .buffer_allocs = buf_allocs_.Get(),
+                   .buffer_reused = buf_reused_.Get(),
+                   .buffer_heap = buf_heap_.Get(),
+                   .cached_bytes = cached_bytes_.Get()};
+}
+
+void* SlabAllocator::ConnAlloc(size_t size) {
+  if (conn_size_ == 0) {
+    /// slots keep free list links and pointers aligned
+    conn_size_ = (size + alignof(std::max_align_t) - 1) /
+                 alignof(std::max_align_t) * alignof(std::max_align_t);
+  }
+  if (size > conn_size_)
+    return calloc(1, size);  // not a slot, ConnFree tells by the size
+  if (conns_ == nullptr) {
+    char* slab = static_cast<char*>(malloc(conn_size_ *
+                                           options_.conns_per_slab));
+    if (slab == nullptr)
+      return nullptr;
+    slabs_.push_back(slab);
+    slab_count_.Add(1);
+    for (size_t i = options_.conns_per_slab; i-- > 0;) {
+      auto* slot = reinterpret_cast<Free*>(slab + i * conn_size_);
+      slot->next = conns_;
+      conns_ = slot;
+    }
+  } else {
+    conn_reused_.Add(1);
+  }
+  Free* slot = conns_;
+  conns_ = slot->next;
+  memset(slot, 0, size);
+  live_conns_.Add(1);
+  conn_allocs_.Add(1);
+  return slot;
+}
+
+void SlabAllocator::ConnFree(void* ptr, size_t size) {
+  if (size > conn_size_) {
+    free(ptr);
+    return;
+  }
+  auto* slot = static_cast<Free*>(ptr);
+  slot->next = conns_;
+  conns_ = slot;
+  live_conns_.Add(-1);
+}
+
+size_t SlabAllocator::Class(size_t size) const {
+  size_t i = 0;
+  while (i < classes_.size() && (size_t{1} << (kMinShift + i)) < size)
+    i++;
+  return i;
+}
+
+void* SlabAllocator::BufAlloc(size_t size) {
+  size_t i = Class(size);
+  buf_allocs_.Add(1);
+  live_bufs_.Add(1);
+  if (i == classes_.size()) {
+    buf_heap_.Add(1);
+    return calloc(1, size);
+  }
+  if (Free* block = classes_[i]; block) {
+    classes_[i] = block->next;
+    cached_ -= size_t{1} << (kMinShift + i);
+    cached_bytes_.Add(-(long(1) << (kMinShift + i)));
+    buf_reused_.Add(1);
+    memset(block, 0, size);
+    return block;
+  }
+  return calloc(1, size_t{1} << (kMinShift + i));
+}
+
+void SlabAllocator::BufFree(void* ptr, size_t size) {
+  size_t i = Class(size);
+  live_bufs_.Add(-1);
+  if (i == classes_.size() ||
+      cached_ + (size_t{1} << (kMinShift + i)) > options_.max_cached) {
+    free(ptr);
+    return;
+  }
+  size_t bytes = size_t{1} << (kMinShift + i);
+  auto* block = static_cast<Free*>(ptr);
+  block->next = classes_[i];
+  classes_[i] = block;
+  cached_ += bytes;
+  cached_bytes_.Add(static_cast<long>(bytes));
+}
+
+}  // namespace mg
@@ -0,0 +1,73 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/20
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "common.h"
+
+namespace mg {
+
+/// mg_allocator of one loop: connections come from slabs of fixed-size
+/// slots, iobuf storage from power-of-two size classes with free lists.
+/// Allocations run on the loop thread only, Stats() from any thread.
+class SlabAllocator {
+ public:
+  explicit SlabAllocator(const SlabOptions& options);
+  /// After mg_mgr_free, every block must be back
+  ~SlabAllocator();
+
+  struct mg_allocator* get() { return &ops_; }
+  SlabStats Stats() const;
+
+ private:
+  static constexpr size_t kMinShift = 9;  // smallest class, 512 bytes
+  struct Free {
+    Free* next;
+  };
+  /// Single writer, readers only load
+  struct Counter {
+    std::atomic<size_t> n = 0;
+    void Add(long d) { n.store(n.load(std::memory_order_relaxed) + d,
+                               std::memory_order_relaxed); }
+    size_t Get() const { return n.load(std::memory_order_relaxed); }
+  };
+
+  void* ConnAlloc(size_t size);
+  void ConnFree(void* ptr, size_t size);
+  void* BufAlloc(size_t size);
+  void BufFree(void* ptr, size_t size);
+  /// Size class of size, classes_.size() when above max_class
+  size_t Class(size_t size) const;
+
+ private:
+  SlabOptions options_;
+  struct mg_allocator ops_;
+  size_t conn_size_ = 0;  // slot size, set by the first connection
+  Free* conns_ = nullptr;
+  std::vector<void*> slabs_;
+  std::vector<Free*> classes_;  // free lists, class i holds 512 << i bytes
+  size_t cached_ = 0;
+  Counter live_conns_, conn_allocs_, conn_reused_, slab_count_;
+  Counter live_bufs_, buf_allocs_, buf_reused_, buf_heap_, cached_bytes_;
+};
+
+}  // namespace mg
@@ -0,0 +1,313 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/12
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <mutex>
+#include "staticcache.h"
+
+namespace mg {
+
+static constexpr uint32_t kWatchMask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                       IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                       IN_MOVED_TO | IN_DELETE_SELF;
+
+/// Whole regular file no bigger than max, with the etag mongoose would give it
+static bool ReadFile(const std::string& path, size_t max, std::string& body,
+                     std::string& etag, bool& too_big) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  too_big = ok && static_cast<size_t>(st.st_size) > max;
+  if (ok && !too_big) {
+    char tag[64];
+    etag = mg_http_etag(tag, sizeof(tag), st.st_size, st.st_mtime);
+    body.resize(st.st_size);
+    size_t n = 0;
+    while (n < body.size()) {
+      ssize_t r = read(fd, body.data() + n, body.size() - n);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        break;
+      n += r;
+    }
+    ok = n == body.size();
+  }
+  close(fd);
+  return ok;
+}
+
+static struct mg_str Trim(struct mg_str s) {
+  while (s.len > 0 && (s.buf[0] == ' ' || s.buf[0] == '\t')) s.buf++, s.len--;
+  while (s.len > 0 && (s.buf[s.len - 1] == ' ' || s.buf[s.len - 1] == '\t'))
+    s.len--;
+  return s;
+}
+
+/// coding listed in Accept-Encoding with a non-zero q
+static bool Accepts(const struct mg_str* ae, std::string_view coding) {
+  if (ae == NULL)
+    return false;
+  struct mg_str s = *ae, item, name, params;
+  while (mg_span(s, &item, &s, ',')) {
+    if (!mg_span(item, &name, &params, ';'))
+      name = item, params = mg_str_n(NULL, 0);
+    name = Trim(name);
+    if (mg_strcasecmp(name, mg_str_n(coding.data(), coding.size())) != 0)
+      continue;
+    struct mg_str q = Trim(params);
+    if (q.len > 2 && (q.buf[0] == 'q' || q.buf[0] == 'Q') && q.buf[1] == '=') {
+      for (size_t i = 2; i < q.len; i++) {
+        if (q.buf[i] != '0' && q.buf[i] != '.')
+          return true;
+      }
+      return false;  // q=0, refused
+    }
+    return true;
+  }
+  return false;
+}
+
+StaticCache::StaticCache(std::string root, HttpCacheOptions options)
+    : root_(std::move(root)), options_(options) {
+  while (root_.size() > 1 && root_.back() == '/') root_.pop_back();
+  inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  stop_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (inotify_ < 0 || stop_ < 0) {
+    LOGE("static cache disabled, inotify: %d", errno);
+    return;
+  }
+  watcher_ = std::make_unique<std::thread>(&StaticCache::WatchRoutine, this);
+}
+
+StaticCache::~StaticCache() {
+  if (watcher_) {
+    uint64_t one = 1;
+    (void)!write(stop_, &one, sizeof(one));
+    watcher_->join();
+  }
+  if (inotify_ >= 0)
+    close(inotify_);
+  if (stop_ >= 0)
+    close(stop_);
+}
+
+bool StaticCache::Serve(struct mg_connection* c, struct mg_http_message* hm) {
+  bool head = mg_strcmp(hm->method, mg_str("HEAD")) == 0;
+  if (!watcher_ || (!head && mg_strcmp(hm->method, mg_str("GET")) != 0) ||
+      mg_http_get_header(hm, "Range") != NULL) {
+    return false;
+  }
+  std::string uri(hm->uri.buf, hm->uri.len);
+  EntryPtr entry;
+  {
+    std::shared_lock<std::shared_mutex> guard(mtx_);
+    if (auto it = entries_.find(uri); it != entries_.end())
+      entry = it->second;
+  }
+  if (!entry && !(entry = Load(uri)))
+    return false;
+  if (entry->variants.empty())
+    return false;  // too big, disk and sendfile serve it better
+
+  struct mg_str* ae = mg_http_get_header(hm, "Accept-Encoding");
+  const Variant* v = &entry->variants.back();
+  for (auto& it : entry->variants) {
+    if (it.encoding.empty() || Accepts(ae, it.encoding)) {
+      v = &it;
+      break;
+    }
+  }
+  struct mg_str* inm = mg_http_get_header(hm, "If-None-Match");
+  if (inm != NULL && mg_strcasecmp(*inm, mg_str(v->etag.c_str())) == 0) {
+    mg_send(c, v->not_modified.data(), v->not_modified.size());
+  } else {
+    mg_send(c, v->response.data(), head ? v->head : v->response.size());
+  }
+  c->is_resp = 0;
+  return true;
+}
+
+StaticCache::EntryPtr StaticCache::Load(const std::string& uri) {
+  char decoded[MG_PATH_MAX];
+  int n = mg_url_decode(uri.data(), uri.size(), decoded, sizeof(decoded), 0);
+  if (n <= 0 || decoded[0] != '/')
+    return nullptr;
+  std::string path = root_ + decoded;
+  if (path.back() == '/')
+    path += MG_HTTP_INDEX;
+  if (!mg_path_is_sane(mg_str(path.c_str())))
+    return nullptr;
+
+  /// Watch first, so a change racing the read below bumps the generation
+  size_t slash = path.rfind('/');
+  if (!Watch(slash == std::string::npos ? "." : path.substr(0, slash)))
+    return nullptr;
+  uint64_t generation;
+  {
+    std::shared_lock<std::shared_mutex> guard(mtx_);
+    generation = generation_;
+  }
+
+  auto entry = std::make_shared<Entry>();
+  entry->path = path;
+  std::string body, etag;
+  bool too_big = false;
+  if (!ReadFile(path, options_.max_file, body, etag, too_big) && !too_big)
+    return nullptr;  // missing or a directory, mongoose replies
+  if (!too_big) {
+    struct mg_str mime = mg_http_content_type(mg_str(path.c_str()), NULL);
+    std::vector<Variant> variants;
+    if (options_.precompressed) {
+      for (const char* encoding : {"br", "gzip"}) {
+        Variant v = {.encoding = encoding};
+        std::string file = path + (v.encoding == "br" ? ".br" : ".gz");
+        bool big = false;
+        if (ReadFile(file, options_.max_file, v.response, v.etag, big))
+          variants.emplace_back(std::move(v));
+      }
+    }
+    variants.emplace_back(Variant{.etag = std::move(etag),
+                                  .response = std::move(body)});
+    const char* vary = variants.size() > 1 ? "Vary: Accept-Encoding\r\n" : "";
+    for (auto& v : variants) {
+      std::string encoding = v.encoding.empty()
+                                 ? std::string()
+                                 : "Content-Encoding: " + v.encoding + "\r\n";
+      char buf[512];
+      int len = snprintf(buf, sizeof(buf),
+                         "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: %.*s\r\n"
+                         "Etag: %s\r\n"
+                         "Content-Length: %zu\r\n"
+                         "%s%s\r\n",
+                         (int)mime.len, mime.buf, v.etag.c_str(),
+                         v.response.size(), encoding.c_str(), vary);
+      if (len <= 0 || static_cast<size_t>(len) >= sizeof(buf))
+        return nullptr;
+      v.head = len;
+      v.response.insert(0, buf, len);
+      v.not_modified = "HTTP/1.1 304 Not Modified\r\nEtag: " + v.etag +
+                       "\r\n" + vary + "Content-Length: 0\r\n\r\n";
+      entry->bytes += v.response.size();
+    }
+    entry->variants = std::move(variants);
+  }
+
+  std::unique_lock<std::shared_mutex> guard(mtx_);
+  if (generation == generation_ && total_ + entry->bytes <= options_.max_total &&
+      entries_.emplace(uri, entry).second) {
+    total_ += entry->bytes;
+  }
+  return entry;  // answers this request even when left out of the cache
+}
+
+bool StaticCache::Watch(const std::string& dir) {
+  {
+    std::shared_lock<std::shared_mutex> guard(mtx_);
+    if (dirs_.count(dir))
+      return true;
+  }
+  int wd = inotify_add_watch(inotify_, dir.c_str(), kWatchMask);
+  if (wd < 0) {
+    LOGD("static cache can not watch %s: %d", dir.c_str(), errno);
+    return false;
+  }
+  std::unique_lock<std::shared_mutex> guard(mtx_);
+  dirs_[dir] = wd;
+  wds_[wd] = dir;
+  return true;
+}
+
+void StaticCache::Invalidate(const std::string& path) {
+  /// foo.js.gz and foo.js.br are variants of foo.js
+  std::string_view base(path);
+  for (std::string_view ext : {".gz", ".br"}) {
+    if (base.size() > ext.size() &&
+        base.compare(base.size() - ext.size(), ext.size(), ext) == 0) {
+      base.remove_suffix(ext.size());
+      break;
+    }
+  }
+  /// caller holds the lock
+  generation_++;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    const std::string& p = it->second->path;
+    if (p == path || p == base ||
+        (p.size() > path.size() && p.compare(0, path.size(), path) == 0 &&
+         p[path.size()] == '/')) {
+      total_ -= it->second->bytes;
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void StaticCache::WatchRoutine() {
+  alignas(struct inotify_event) char buf[4096];
+  struct pollfd fds[2] = {{.fd = inotify_, .events = POLLIN},
+                          {.fd = stop_, .events = POLLIN}};
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+    ssize_t n;
+    while ((n = read(inotify_, buf, sizeof(buf))) > 0) {
+      std::unique_lock<std::shared_mutex> guard(mtx_);
+      for (char* p = buf; p < buf + n;) {
+        auto* ev = reinterpret_cast<struct inotify_event*>(p);
+        p += sizeof(*ev) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) {
+          generation_++;
+          entries_.clear();
+          total_ = 0;
+          continue;
+        }
+        auto it = wds_.find(ev->wd);
+        if (it == wds_.end())
+          continue;
+        std::string path = it->second;
+        if (ev->len > 0)
+          path = path + "/" + ev->name;
+        Invalidate(path);
+        if (ev->mask & IN_IGNORED) {
+          dirs_.erase(it->second);
+          wds_.erase(it);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace mg
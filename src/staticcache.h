@@ -0,0 +1,83 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/12
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "options.h"
+
+namespace mg {
+
+/// serve_dir files held in memory as ready-made responses, shared by every
+/// loop of an HttpServer. Entries are dropped on inotify events.
+class StaticCache {
+ public:
+  StaticCache(std::string root, HttpCacheOptions options);
+  ~StaticCache();
+
+  /// Answer a GET/HEAD from memory, false when it has to go to disk
+  bool Serve(struct mg_connection* c, struct mg_http_message* hm);
+  /// Number of cached uris, callable from any thread
+  size_t Size() {
+    std::shared_lock<std::shared_mutex> lock(mtx_);
+    return entries_.size();
+  }
+
+ private:
+  struct Variant {
+    std::string encoding;  // empty for identity
+    std::string etag;
+    std::string response;  // head and body
+    size_t head;           // head length, all a HEAD gets
+    std::string not_modified;
+  };
+  struct Entry {
+    std::string path;               // file on disk
+    std::vector<Variant> variants;  // by preference, identity last
+    size_t bytes = 0;
+  };
+  using EntryPtr = std::shared_ptr<const Entry>;
+
+  EntryPtr Load(const std::string& uri);
+  bool Watch(const std::string& dir);
+  void Invalidate(const std::string& path);
+  void WatchRoutine();
+
+ private:
+  std::string root_;
+  HttpCacheOptions options_;
+  std::shared_mutex mtx_;
+  std::unordered_map<std::string, EntryPtr> entries_;  // by request uri
+  std::unordered_map<std::string, int> dirs_;          // watched, dir -> wd
+  std::unordered_map<int, std::string> wds_;
+  size_t total_ = 0;
+  uint64_t generation_ = 0;  // bumped by every invalidation
+  int inotify_ = -1;
+  int stop_ = -1;  // eventfd waking the watcher up on destruction
+  std::unique_ptr<std::thread> watcher_;
+};
+
+}  // namespace mg
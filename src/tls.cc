@@ -0,0 +1,94 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/08
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common.h"
+#include "tls.h"
+
+namespace mg {
+
+/// Packed fs path or the credential itself
+static std::string Load(std::string s) {
+  struct mg_str packed = mg_unpacked(s.c_str());
+  return packed.len ? std::string(packed.buf, packed.len) : s;
+}
+
+TlsContext::TlsContext(std::string ca, std::string cert, std::string key)
+    : creds_(Parse(std::move(ca), std::move(cert), std::move(key))) {}
+
+std::shared_ptr<const TlsContext::Creds> TlsContext::Parse(std::string ca,
+                                                          std::string cert,
+                                                          std::string key) {
+  auto creds = std::make_shared<Creds>();
+  creds->ca = Load(std::move(ca));
+  creds->cert = Load(std::move(cert));
+  creds->key = Load(std::move(key));
+  struct mg_tls_opts opts = {.ca = mg_str(creds->ca.c_str()),
+                             .cert = mg_str(creds->cert.c_str()),
+                             .key = mg_str(creds->key.c_str())};
+  if (void* ctx = mg_tls_shared_new(&opts); ctx) {
+    creds->ctx = std::shared_ptr<void>(ctx, &mg_tls_shared_free);
+  }
+#if MG_TLS == MG_TLS_OPENSSL || MG_TLS == MG_TLS_WOLFSSL
+  else {
+    return nullptr;  // backend supports it, so the credentials are bad
+  }
+#endif
+  return creds;
+}
+
+bool TlsContext::Reload(std::string ca, std::string cert, std::string key) {
+  auto creds = Parse(std::move(ca), std::move(cert), std::move(key));
+  if (!creds) {
+    LOGE("TLS reload failed, keeping current credentials");
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(mtx_);
+  creds_ = std::move(creds);
+  return true;
+}
+
+bool TlsContext::Shared() const {
+  std::lock_guard<std::mutex> guard(mtx_);
+  return creds_ && creds_->ctx;
+}
+
+void TlsContext::Init(struct mg_connection* c, std::string_view name) const {
+  std::shared_ptr<const Creds> creds;
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    creds = creds_;
+  }
+  if (!creds) {
+    mg_error(c, "TLS credentials");
+    return;
+  }
+  struct mg_tls_opts opts = {.name = mg_str_n(name.data(), name.size())};
+  if (creds->ctx) {
+    opts.shared = creds->ctx.get();  // the connection takes its own reference
+  } else {
+    opts.ca = mg_str(creds->ca.c_str());
+    opts.cert = mg_str(creds->cert.c_str());
+    opts.key = mg_str(creds->key.c_str());
+  }
+  mg_tls_init(c, &opts);
+}
+
+}  // namespace mg
@@ -0,0 +1,174 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/05
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uring.h"
+
+#if defined(MG_ENABLE_IO_URING) && MG_ENABLE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct mg_uring {
+  int fd;
+  unsigned pending;  // queued, not yet submitted
+  unsigned inflight;  // submitted, not yet reaped
+  // Submission ring
+  void *sq_ptr;
+  size_t sq_sz;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_sz;
+  // Completion ring
+  void *cq_ptr;
+  size_t cq_sz;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned min, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, submit, min, flags, NULL, 0);
+}
+
+struct mg_uring *mg_uring_new(unsigned entries) {
+  struct io_uring_params p;
+  struct mg_uring *u = (struct mg_uring *) calloc(1, sizeof(*u));
+  if (u == NULL) return NULL;
+  memset(&p, 0, sizeof(p));
+  if ((u->fd = sys_setup(entries, &p)) < 0) {
+    free(u);
+    return NULL;
+  }
+  u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_sz > u->sq_sz) u->sq_sz = u->cq_sz;
+    u->cq_sz = u->sq_sz;
+  }
+  u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  u->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP)
+                  ? u->sq_ptr
+                  : mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  u->sqes = (struct io_uring_sqe *) mmap(NULL, u->sqes_sz,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, u->fd,
+                                         IORING_OFF_SQES);
+  if (u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED ||
+      u->sqes == MAP_FAILED) {
+    mg_uring_free(u);
+    return NULL;
+  }
+  u->sq_head = (unsigned *) ((char *) u->sq_ptr + p.sq_off.head);
+  u->sq_tail = (unsigned *) ((char *) u->sq_ptr + p.sq_off.tail);
+  u->sq_mask = (unsigned *) ((char *) u->sq_ptr + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *) ((char *) u->sq_ptr + p.sq_off.array);
+  u->cq_head = (unsigned *) ((char *) u->cq_ptr + p.cq_off.head);
+  u->cq_tail = (unsigned *) ((char *) u->cq_ptr + p.cq_off.tail);
+  u->cq_mask = (unsigned *) ((char *) u->cq_ptr + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ptr + p.cq_off.cqes);
+  return u;
+}
+
+void mg_uring_free(struct mg_uring *u) {
+  if (u == NULL) return;
+  if (u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_sz);
+  if (u->cq_ptr != NULL && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+    munmap(u->cq_ptr, u->cq_sz);
+  if (u->sq_ptr != NULL && u->sq_ptr != MAP_FAILED) munmap(u->sq_ptr, u->sq_sz);
+  close(u->fd);
+  free(u);
+}
+
+static bool prep(struct mg_uring *u, int op, int fd, const void *buf,
+                 size_t len, uint64_t tag) {
+  unsigned tail = *u->sq_tail;
+  unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+  unsigned idx = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+  if (tail - head > *u->sq_mask) return false;  // ring full
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = (uint8_t) op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = (uint32_t) len;
+  // Sockets are ready per epoll: complete inline or fail with -EAGAIN, never
+  // park the request, so mg_uring_wait() does not block
+  sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+  sqe->user_data = tag;
+  u->sq_array[idx] = idx;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->pending++;
+  return true;
+}
+
+bool mg_uring_recv(struct mg_uring *u, int fd, void *buf, size_t len,
+                   uint64_t tag) {
+  return prep(u, IORING_OP_RECV, fd, buf, len, tag);
+}
+
+bool mg_uring_send(struct mg_uring *u, int fd, const void *buf, size_t len,
+                   uint64_t tag) {
+  return prep(u, IORING_OP_SEND, fd, buf, len, tag);
+}
+
+bool mg_uring_wait(struct mg_uring *u) {
+  unsigned submit = u->pending, want = u->pending + u->inflight;
+  while (submit > 0 || want > 0) {
+    unsigned done = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head;
+    int rc;
+    if (submit == 0 && done >= want) break;
+    rc = sys_enter(u->fd, submit, want, IORING_ENTER_GETEVENTS);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    submit -= (unsigned) rc;
+    u->pending -= (unsigned) rc;
+    u->inflight += (unsigned) rc;
+  }
+  return true;
+}
+
+bool mg_uring_reap(struct mg_uring *u, uint64_t *tag, long *res) {
+  unsigned head = *u->cq_head;
+  struct io_uring_cqe *cqe;
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return false;
+  cqe = &u->cqes[head & *u->cq_mask];
+  *tag = cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+  if (u->inflight > 0) u->inflight--;
+  return true;
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/05
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+// Minimal io_uring engine used by mg_mgr_poll() when MG_ENABLE_IO_URING=1.
+// Raw syscalls, no liburing dependency. Requests are queued with
+// mg_uring_recv()/mg_uring_send() and carried out together by a single
+// io_uring_enter() in mg_uring_wait().
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mg_uring;
+
+struct mg_uring *mg_uring_new(unsigned entries);
+void mg_uring_free(struct mg_uring *u);
+// Queue a request, false when the submission queue is full
+bool mg_uring_recv(struct mg_uring *u, int fd, void *buf, size_t len,
+                   uint64_t tag);
+bool mg_uring_send(struct mg_uring *u, int fd, const void *buf, size_t len,
+                   uint64_t tag);
+// Submit queued requests and wait for all of them, one syscall
+bool mg_uring_wait(struct mg_uring *u);
+// Pop one completion, false when none left. res is bytes or -errno
+bool mg_uring_reap(struct mg_uring *u, uint64_t *tag, long *res);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/16
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "workpool.h"
+
+namespace mg {
+
+WorkPool::WorkPool(size_t threads, size_t capacity,
+                   std::function<void()> on_space)
+    : capacity_(capacity), on_space_(std::move(on_space)) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; i++)
+    queues_.emplace_back(std::make_unique<Queue>());
+  for (size_t i = 0; i < threads; i++)
+    threads_.emplace_back(&WorkPool::Routine, this, i);
+}
+
+WorkPool::~WorkPool() {
+  {
+    std::lock_guard<std::mutex> guard(idle_mtx_);
+    stop_ = true;
+  }
+  idle_cv_.notify_all();
+  for (auto& t : threads_)
+    t.join();
+}
+
+bool WorkPool::Submit(Task task) {
+  if (pending_.fetch_add(1, std::memory_order_acq_rel) >= capacity_) {
+    refused_.store(true, std::memory_order_release);
+    pending_.fetch_sub(1, std::memory_order_acq_rel);
+    /// every task may have finished before refused_ was seen
+    if (pending_.load(std::memory_order_acquire) < capacity_ &&
+        refused_.exchange(false, std::memory_order_acq_rel) && on_space_)
+      on_space_();
+    return false;
+  }
+  auto& q = *queues_[next_++ % queues_.size()];
+  {
+    std::lock_guard<std::mutex> guard(q.mtx);
+    q.tasks.emplace_back(std::move(task));
+  }
+  {
+    /// under idle_mtx_ so a thread about to sleep can not miss it
+    std::lock_guard<std::mutex> guard(idle_mtx_);
+    queued_.fetch_add(1, std::memory_order_release);
+  }
+  idle_cv_.notify_one();
+  return true;
+}
+
+bool WorkPool::Take(size_t self, Task& task) {
+  for (size_t i = 0; i < queues_.size(); i++) {
+    auto& q = *queues_[(self + i) % queues_.size()];
+    std::lock_guard<std::mutex> guard(q.mtx);
+    if (q.tasks.empty())
+      continue;
+    if (i == 0) {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    } else {
+      task = std::move(q.tasks.back());  // steal the newest
+      q.tasks.pop_back();
+    }
+    queued_.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+  }
+  return false;
+}
+
+void WorkPool::Routine(size_t self) {
+  for (;;) {
+    Task task;
+    if (!Take(self, task)) {
+      std::unique_lock<std::mutex> lk(idle_mtx_);
+      idle_cv_.wait(lk, [this] {
+        return stop_ || queued_.load(std::memory_order_acquire) > 0;
+      });
+      if (stop_)
+        return;  // queued tasks are dropped
+      continue;
+    }
+    task();
+    task = nullptr;
+    pending_.fetch_sub(1, std::memory_order_acq_rel);
+    if (refused_.exchange(false, std::memory_order_acq_rel) && on_space_)
+      on_space_();
+  }
+}
+
+}  // namespace mg
@@ -0,0 +1,71 @@
+/*
+ * Mongoose Wrapper
+ * Implemented by C++
+ *
+ * Author wanch
+ * Date 2025/12/16
+ * Email wzhhnet@gmail.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mg {
+
+/// Bounded pool of threads, each with its own deque. Tasks are spread
+/// round-robin, owners take from the front and idle threads steal from the
+/// back of the others.
+class WorkPool {
+ public:
+  using Task = std::function<void()>;
+
+  /// on_space runs on a pool thread once a slot frees after a refusal
+  WorkPool(size_t threads, size_t capacity, std::function<void()> on_space);
+  ~WorkPool();
+
+  /// Queue task from any thread, false when capacity tasks are pending
+  bool Submit(Task task);
+
+ private:
+  struct Queue {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+
+  bool Take(size_t self, Task& task);
+  void Routine(size_t self);
+
+ private:
+  const size_t capacity_;
+  std::function<void()> on_space_;
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> pending_ = 0;  // queued or running
+  std::atomic<size_t> queued_ = 0;
+  std::atomic<size_t> next_ = 0;
+  std::atomic<bool> refused_ = false;
+  std::mutex idle_mtx_;
+  std::condition_variable idle_cv_;
+  bool stop_ = false;
+};
+
+}  // namespace mg